@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "stats.h"
+
+#define ARENA_CHUNKSIZE     ( 1 << 16 )
+#define ARENA_ALIGN         8
+
+typedef struct chunk Chunk;
+
+struct chunk
+{
+    Chunk * next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+// Allocations come from the head chunk, the tail is only kept for merging
+struct arena
+{
+    Chunk * head;
+    Chunk * tail;
+};
+
+static Chunk * CHK_New( size_t size )
+{
+    Chunk * chunk = ( Chunk* )malloc( sizeof( Chunk ) + size );
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    
+    return chunk;
+}
+
+Arena * ARN_New()
+{
+    Arena * arn = ( Arena* )malloc( sizeof( Arena ) );
+    STS_CountAlloc();
+    arn->head = CHK_New( ARENA_CHUNKSIZE );
+    arn->tail = arn->head;
+    
+    return arn;
+}
+
+void ARN_Delete( Arena * arn )
+{
+    if( !arn )
+        return;
+        
+    Chunk * chunk = arn->head;
+    
+    while( chunk )
+    {
+        Chunk * next = chunk->next;
+        free( chunk );
+        chunk = next;
+    }
+    
+    free( arn );
+}
+
+void * ARN_Alloc( Arena * arn, size_t size )
+{
+    Chunk * head = arn->head;
+    STS_CountAlloc();
+    size = ( size + ARENA_ALIGN - 1 ) & ~( size_t )( ARENA_ALIGN - 1 );
+    
+    if( head->used + size > head->size )
+    {
+        // Oversized requests get a chunk of their own behind the head, so
+        // the space left in the head is not wasted
+        if( size > ARENA_CHUNKSIZE / 4 )
+        {
+            Chunk * big = CHK_New( size );
+            big->used = size;
+            big->next = head->next;
+            head->next = big;
+            
+            if( arn->tail == head )
+                arn->tail = big;
+                
+            return big->data;
+        }
+        
+        head = CHK_New( ARENA_CHUNKSIZE );
+        head->next = arn->head;
+        arn->head = head;
+    }
+    
+    void * ptr = head->data + head->used;
+    head->used += size;
+    
+    return ptr;
+}
+
+char * ARN_Strndup( Arena * arn, const char * text, size_t length )
+{
+    char * copy = ( char* )ARN_Alloc( arn, length + 1 );
+    memcpy( copy, text, length );
+    copy[length] = '\0';
+    
+    return copy;
+}
+
+// Moves every chunk of src into dst and deletes src
+void ARN_Merge( Arena * dst, Arena * src )
+{
+    if( !src || dst == src )
+        return;
+        
+    dst->tail->next = src->head;
+    dst->tail = src->tail;
+    
+    free( src );
+}
@@ -0,0 +1,22 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator. Memory is taken from large chunks and only given back
+// all at once, when the arena is deleted.
+
+typedef struct arena Arena;
+
+
+Arena * ARN_New();
+
+void ARN_Delete( Arena * arn );
+
+void * ARN_Alloc( Arena * arn, size_t size );
+
+char * ARN_Strndup( Arena * arn, const char * text, size_t length );
+
+void ARN_Merge( Arena * dst, Arena * src );
+
+#endif
@@ -5,6 +5,9 @@
 
 #include "ast.h"
 #include "token.h"
+#include "intern.h"
+#include "arena.h"
+#include "stats.h"
 
 
 // Abract Syntax Node
@@ -13,90 +16,36 @@ typedef struct node Node;
 struct node
 {
 	int type;
-	char * value;
+	char * value;       // Interned, compare by address
 	int line;
 	Symbol * annotation;
 	Node * parent;
 	Node * next;
 	Node * prev;
 	Node * child;
+	Node * last;        // Last child, so appending does not walk the siblings
 };
 
-Node * ASN_New( int type, char * value, int line )
+Node * ASN_New( Arena * arena, int type, char * value, int line )
 {
-	Node * node = ( Node* )malloc( sizeof( Node ) );
+	Node * node = ( Node* )ARN_Alloc( arena, sizeof( Node ) );
 	node->type = type;
 	node->line = line;
 	node->annotation = NULL;	
 	node->value = NULL;
 	
 	if( value )	
-		node->value = strdup( value );	
+		node->value = ITN_InternString( value );	
 	
 	node->parent = NULL;
 	node->next = NULL;
 	node->prev = NULL;
 	node->child = NULL;
+	node->last = NULL;
 	
 	return node;
 }
 
-void ASN_Delete( Node * node )
-{
-    if( node )
-    {
-	    Node * next = node->child;
-	    Node * toDelete;
-	
-	    while( next )
-	    {
-	        toDelete = next;
-	        next = next->next;
-	        ASN_Delete( toDelete );
-	    }	
-        
-        if( node->next )
-        {
-            if( node->prev )
-            {
-                node->next->prev = node->prev;
-                node->prev->next = node->next;
-            }
-            else
-            {
-                node->next->prev = NULL;
-                
-                if( node->parent )
-                    node->parent->child = node->next;
-            }
-        }
-        else
-        {
-            if( node->prev )
-            {
-                node->prev->next = NULL;            
-            }
-            else
-            {  
-                if( node->parent )          
-                    node->parent->child = NULL;
-            }
-        }
-		
-	    if( node->value )
-	        free( node->value );
-	    
-	    if( node->annotation )
-	    {
-    	    SYM_Delete( node->annotation );
-    	    node->annotation = NULL;
-    	}
-    	        
-	    free( node );
-	    node = NULL;
-	}
-}
-
 char * ASN_ToString( int type )
 {
     char * str = ( char* )malloc( 16 * sizeof( char ) );
@@ -240,94 +189,128 @@ char * ASN_ToString( int type )
     return str;
 }
 
-void ASN_Dump( Node * node, int depth )
-{
-    assert( node != NULL );    
-    
-    char * str = ASN_ToString( node->type );
-    char * type = SYM_SymbolToString( node->annotation );
-    printf( "%s ", str );
-    
-    if( node->value )
-        printf( "%s ", node->value );        
-    
-    if( strcmp( type, "" ) != 0 )
-        printf("of %s ", type );
-        
-    printf("@%d\n", node->line );
-    
-    free( str );
-    free( type );
-    
-    Node * currChild = node->child;
-        
-    if( currChild )
-    {
-        do
-        {
-            int i;
-            for( i = 0; i < depth; i++ )
-                printf("\t");
-                
-            ASN_Dump( currChild, depth + 1 );
-            currChild = currChild->next;
-        } 
-        while( currChild );
-    }
-}
-
 // Abract Syntax Tree
+// While it is built, nodes are allocated from an arena shared by every Ast
+// made with AST_NewFrom, and only the Ast made with AST_New owns and frees
+// it. AST_Flatten then moves the tree into parallel arrays in pre-order,
+// linked by indices, which is the only form the handles read.
 struct ast
 {
 	Node * root;
 	Node * current;	
+	Arena * arena;
+	int ownsArena;
+	
+	// Flat form, -1 is the null index
+	int nNodes;
+	int maxNodes;
+	int * types;
+	int * lines;
+	char ** values;
+	Symbol ** annotations;
+	int * sizes;        // Nodes in the subtree, itself included
+	int * nexts;        // Next sibling
 };
 
-Ast * AST_New()
+static Ast * AST_Wrap( Node * root, Arena * arena, int ownsArena )
 {
 	Ast * ast = ( Ast* )malloc( sizeof( Ast ) );
-	ast->root = NULL;
+	STS_CountAlloc();
+	ast->root = root;
 	ast->current = NULL;	
+	ast->arena = arena;
+	ast->ownsArena = ownsArena;
+	ast->nNodes = 0;
+	ast->maxNodes = 0;
+	ast->types = NULL;
+	ast->lines = NULL;
+	ast->values = NULL;
+	ast->annotations = NULL;
+	ast->sizes = NULL;
+	ast->nexts = NULL;
 	
 	return ast;
 }
 
+Ast * AST_New()
+{
+	return AST_Wrap( NULL, ARN_New(), 1 );
+}
+
+Ast * AST_NewFrom( Ast * ast )
+{
+	return AST_Wrap( NULL, ast->arena, 0 );
+}
+
+// Frees every node of the arena at once when ast owns it. Annotations
+// are not owned by the tree.
 void AST_Delete( Ast * ast )
 {
     if( ast )
     {
-	    ASN_Delete( ast->root );	
+        if( ast->ownsArena )
+	        ARN_Delete( ast->arena );	
+	        
+	    free( ast->types );
+	    free( ast->lines );
+	    free( ast->values );
+	    free( ast->annotations );
+	    free( ast->sizes );
+	    free( ast->nexts );
     	free( ast );    	
     }
 }
 
+// A child with an arena of its own hands it over to the parent's
+static void AST_Adopt( Ast * parent, Ast * child )
+{
+    if( child->ownsArena && child->arena != parent->arena )
+    {
+        ARN_Merge( parent->arena, child->arena );
+        child->ownsArena = 0;
+    }
+}
+
+static void ASN_PrependChild( Node * parent, Node * child )
+{
+    Node * first = parent->child;
+    
+    child->parent = parent;
+    child->next = first;
+    parent->child = child;
+    
+    if( first )
+        first->prev = child;
+    else
+        parent->last = child;
+}
+
+static void ASN_AppendChild( Node * parent, Node * child )
+{
+    Node * last = parent->last;
+    
+    child->parent = parent;
+    child->prev = last;
+    parent->last = child;
+    
+    if( last )
+        last->next = child;
+    else
+        parent->child = child;
+}
+
 void AST_PrependChildTree( Ast * parent, Ast * child )
 {
     if( parent && child )
     {
         Node * childNode = child->root;
         
+        AST_Adopt( parent, child );
+        
         if( parent->root && childNode )
-        {	
-	        Node * currChild = parent->root->child;
-		
-	        if( currChild )
-	        {
-		        currChild->prev = childNode;
-		        childNode->next = currChild;
-		        childNode->parent = currChild->parent;
-		        currChild->parent->child = childNode;		        
-	        }
-	        else
-	        {
-		        parent->root->child = childNode;
-		        childNode->parent = parent->root;
-	        }
-	    }
+            ASN_PrependChild( parent->root, childNode );
 	    else
-	    {
 	        parent->root = childNode;
-	    }
 	}
 	
 	free( child );
@@ -339,62 +322,51 @@ void AST_AppendChildTree( Ast * parent, Ast * child )
     {
         Node * childNode = child->root;
         
+        AST_Adopt( parent, child );
+        
         if( parent->root && childNode )
-        {	
-	        Node * currChild = parent->root->child;
-		
-	        if( currChild )
-	        {
-		        while( currChild->next )
-			        currChild = currChild->next;
-		
-		        currChild->next = childNode;
-		        childNode->prev = currChild;
-		        childNode->parent = currChild->parent;
-	        }
-	        else
-	        {
-		        parent->root->child = childNode;
-		        childNode->parent = parent->root;
-	        }
-	    }
+            ASN_AppendChild( parent->root, childNode );
 	    else
-	    {
 	        parent->root = childNode;
-	    }
 	}
 	
 	free( child );
 }
 
+// Moves every child of child's root under parent's root, in order, and
+// drops the rest of child
+void AST_AppendChildren( Ast * parent, Ast * child )
+{
+    if( parent && child && child->root )
+    {
+        Node * node = child->root->child;
+        
+        AST_Adopt( parent, child );
+        
+        while( node )
+        {
+            Node * next = node->next;
+            
+            node->next = NULL;
+            ASN_AppendChild( parent->root, node );
+            node = next;
+        }
+    }
+    
+    AST_Delete( child );
+}
+
 void AST_PrependChildNode( Ast * parent, int type, char * text, int line )
 {
     if( !parent )
         return;
     
-    Node * child = ASN_New( type, text, line );
+    Node * child = ASN_New( parent->arena, type, text, line );
     
     if( parent->root )
-    {	
-        Node * currChild = parent->root->child;
-	
-        if( currChild )
-        {
-            currChild->prev = child;
-            child->next = currChild;
-            child->parent = currChild->parent;
-            currChild->parent->child = child;
-        }
-        else
-        {
-	        parent->root->child = child;
-	        child->parent = parent->root;
-        }
-    }
+        ASN_PrependChild( parent->root, child );
     else
-    {
         parent->root = child;
-    }	
 }
 
 void AST_AppendChildNode( Ast * parent, int type, char * text, int line )
@@ -402,31 +374,12 @@ void AST_AppendChildNode( Ast * parent, int type, char * text, int line )
     if( !parent )
         return;
         
-    Node * child = ASN_New( type, text, line );
+    Node * child = ASN_New( parent->arena, type, text, line );
         
     if( parent->root )
-    {	
-        Node * currChild = parent->root->child;
-	
-        if( currChild )
-        {
-	        while( currChild->next )
-		        currChild = currChild->next;
-	
-	        currChild->next = child;
-	        child->prev = currChild;
-	        child->parent = currChild->parent;
-        }
-        else
-        {
-	        parent->root->child = child;
-	        child->parent = parent->root;
-        }
-    }
+        ASN_AppendChild( parent->root, child );
     else
-    {
         parent->root = child;
-    }
 }
 
 int AST_TokenTypeToAst( int tokenType )
@@ -489,136 +442,235 @@ int AST_TokenTypeToAst( int tokenType )
     }
 }
 
+static void AST_Grow( Ast * ast )
+{
+    ast->maxNodes = ast->maxNodes ? 2 * ast->maxNodes : 256;
+    ast->types = realloc( ast->types, ast->maxNodes * sizeof( int ) );
+    ast->lines = realloc( ast->lines, ast->maxNodes * sizeof( int ) );
+    ast->values = realloc( ast->values, ast->maxNodes * sizeof( char* ) );
+    ast->annotations = realloc( ast->annotations, ast->maxNodes * sizeof( Symbol* ) );
+    ast->sizes = realloc( ast->sizes, ast->maxNodes * sizeof( int ) );
+    ast->nexts = realloc( ast->nexts, ast->maxNodes * sizeof( int ) );
+}
+
+static int AST_FlattenNode( Ast * ast, Node * node )
+{
+    if( ast->nNodes == ast->maxNodes )
+        AST_Grow( ast );
+        
+    int index = ast->nNodes++;
+    int last = -1;
+    Node * child;
+    
+    ast->types[index] = node->type;
+    ast->lines[index] = node->line;
+    ast->values[index] = node->value;
+    ast->annotations[index] = node->annotation;
+    ast->nexts[index] = -1;
+    
+    for( child = node->child; child; child = child->next )
+    {
+        int childIndex = AST_FlattenNode( ast, child );
+        
+        if( last >= 0 )
+            ast->nexts[last] = childIndex;
+            
+        last = childIndex;
+    }
+    
+    ast->sizes[index] = ast->nNodes - index;
+    
+    return index;
+}
+
+// Moves the tree into the flat arrays and releases the linked nodes.
+// Nothing can be appended afterwards.
+void AST_Flatten( Ast * ast )
+{
+    if( ast->root )
+        AST_FlattenNode( ast, ast->root );
+        
+    ast->root = NULL;
+    
+    if( ast->ownsArena )
+    {
+        ARN_Delete( ast->arena );
+        ast->arena = NULL;
+        ast->ownsArena = 0;
+    }
+}
+
+static void AST_DumpNode( Ast * ast, int index, int depth )
+{
+    char * str = ASN_ToString( ast->types[index] );
+    char * type = SYM_SymbolToString( ast->annotations[index] );
+    printf( "%s ", str );
+    
+    if( ast->values[index] )
+        printf( "%s ", ast->values[index] );        
+    
+    if( strcmp( type, "" ) != 0 )
+        printf("of %s ", type );
+        
+    printf("@%d\n", ast->lines[index] );
+    
+    free( str );
+    free( type );
+    
+    int child = ( ast->sizes[index] > 1 ) ? index + 1 : -1;
+        
+    for( ; child >= 0; child = ast->nexts[child] )
+    {
+        int i;
+        for( i = 0; i < depth; i++ )
+            printf("\t");
+            
+        AST_DumpNode( ast, child, depth + 1 );
+    }
+}
+
 void AST_Dump( Ast * ast )
 {
     if( !ast )
         return;
         
     printf( "\n=======AST=======\n" );
-    ASN_Dump( ast->root, 1 );
+    
+    assert( ast->nNodes > 0 );
+    AST_DumpNode( ast, 0, 1 );
 }
 
-int AST_GetNodeType( Ast * ast )
+// Number of nodes of a flattened tree
+int AST_GetSize( Ast * ast )
 {
-    return ast->root->type;
+    return ast->nNodes;
 }
 
-char * AST_GetNodeValue( Ast * ast )
+static AstNode AST_Handle( Ast * ast, int index )
 {
-    return ast->root->value;    
+    AstNode node = { ast, index };
+    return node;
 }
 
-int AST_GetNodeLine( Ast * ast )
+AstNode AST_GetRoot( Ast * ast )
 {
-    return ast->root->line;
+    return AST_Handle( ast, ast->nNodes ? 0 : -1 );
 }
 
-Symbol * AST_GetNodeAnnotation( Ast * ast )
+int AST_IsNull( AstNode node )
 {
-    return ast->root->annotation;
+    return ( node.index < 0 );
 }
 
-void AST_Annotate( Ast * ast, Symbol * sym )
+int AST_GetNodeType( AstNode node )
 {
-    assert( ast->root->annotation == NULL );
+    return node.ast->types[node.index];
+}
+
+char * AST_GetNodeValue( AstNode node )
+{
+    return node.ast->values[node.index];    
+}
+
+int AST_GetNodeLine( AstNode node )
+{
+    return node.ast->lines[node.index];
+}
+
+Symbol * AST_GetNodeAnnotation( AstNode node )
+{
+    return node.ast->annotations[node.index];
+}
+
+void AST_Annotate( AstNode node, Symbol * sym )
+{
+    assert( node.ast->annotations[node.index] == NULL );
     
-    ast->root->annotation = sym;
+    node.ast->annotations[node.index] = sym;
 }
 
-Ast * AST_GetChild( Ast * ast )
+// Both return a null handle when there is no such node. In pre-order the
+// first child always comes right after its parent.
+AstNode AST_GetChild( AstNode node )
 {
-	if( !ast )
-		return NULL;
-		
-	if( !ast->root )
-		return NULL;
-	
-	if( !ast->root->child )
-		return NULL;
-		
-	Ast * child = AST_New();
-	child->root = ast->root->child;
-		
-	return child;
+    if( node.index < 0 || node.ast->sizes[node.index] == 1 )
+        return AST_Handle( node.ast, -1 );
+        
+    return AST_Handle( node.ast, node.index + 1 );
 }
 
-int AST_HasNext( Ast * ast )
+int AST_HasNext( AstNode node )
 {
-    return ( ast->root->next != NULL );
+    return ( node.ast->nexts[node.index] >= 0 );
 }
 
-Ast * AST_NextSibling( Ast * ast )
+AstNode AST_NextSibling( AstNode node )
 {
-	if( !ast )
-		return NULL;
-		
-	if( !ast->root )
-	{
-	    free( ast );
-		return NULL;
-    }
-		
-	if( !ast->root->next )
-	{
-	    free( ast );
-		return NULL;
-	}
-		
-	Ast * sibling = AST_New();
-	sibling->root = ast->root->next;
-	
-	free( ast );
-	
-	return sibling;
+    if( node.index < 0 )
+        return node;
+        
+    return AST_Handle( node.ast, node.ast->nexts[node.index] );
+}
+
+// Nodes of the subtree rooted at node, which in pre-order are the ones
+// right after it
+int AST_GetTreeSize( AstNode node )
+{
+    return node.ast->sizes[node.index];
+}
+
+AstNode AST_NextInOrder( AstNode node )
+{
+    if( node.index < 0 || node.index + 1 >= node.ast->nNodes )
+        return AST_Handle( node.ast, -1 );
+        
+    return AST_Handle( node.ast, node.index + 1 );
 }
 
-char * AST_FindId( Ast * ast )
+char * AST_FindId( AstNode node )
 {
-    int type = ast->root->type;
+    int type = AST_GetNodeType( node );
     
     if( type != A_FUNCTION && type != A_CALL && type != A_VAR && type != A_DECLVAR )
         return NULL;
         
-    Node * child;
+    AstNode child;
     
-    for( child = ast->root->child; child; child = child->next )
+    for( child = AST_GetChild( node ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
     {
-        if( child->type == A_ID )
-            return child->value;
+        if( AST_GetNodeType( child ) == A_ID )
+            return AST_GetNodeValue( child );
     }
     
     return NULL;
 }
 
-char * AST_FindType( Ast * ast, int * outPtr )
+char * AST_FindType( AstNode node, int * outPtr )
 {
-    int type = ast->root->type;
-    
     *outPtr = 0;
-    Node * child;
+    AstNode child;
     
-    for( child = ast->root->child; child; child = child->next )
+    for( child = AST_GetChild( node ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
     {
-        if( child->type == A_TYPE )
+        if( AST_GetNodeType( child ) == A_TYPE )
         {            
-            child = child->child;
+            child = AST_GetChild( child );
             
-            while( strcmp( child->value, "[]" ) == 0 )
+            while( strcmp( AST_GetNodeValue( child ), "[]" ) == 0 )
             {
                 ( *outPtr )++;
-                child = child->next;
+                child = AST_NextSibling( child );
             }
             
-            if( strcmp( child->value, "string" ) == 0 )
+            if( strcmp( AST_GetNodeValue( child ), "string" ) == 0 )
             {
                 ( *outPtr )++;
                 return "char";
             }
                 
-            return child->value;
+            return AST_GetNodeValue( child );
         }
     }
     
     return NULL;
 }
-
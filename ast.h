@@ -56,43 +56,67 @@ expressar composição de "terminals" da parte "Expressions".
 
 typedef struct ast Ast;
 
+// Handle to a node of a flattened tree (see AST_Flatten), passed around by
+// value. Walking the tree through handles never allocates.
+typedef struct astNode
+{
+    Ast * ast;
+    int index;
+} AstNode;
+
 
 Ast * AST_New();
 
+Ast * AST_NewFrom( Ast * ast );
+
 void AST_Delete( Ast * ast );
 
 void AST_PrependChildTree( Ast * parent, Ast * child );
 
 void AST_AppendChildTree( Ast * parent, Ast * child );
 
+void AST_AppendChildren( Ast * parent, Ast * child );
+
 void AST_PrependChildNode( Ast * parent, int type, char * text, int line );
 
 void AST_AppendChildNode( Ast * parent, int type, char * text, int line );
 
 int AST_TokenTypeToAst( int tokenType );
 
+void AST_Flatten( Ast * ast );
+
 void AST_Dump( Ast * ast );
 
+int AST_GetSize( Ast * ast );
+
+
+AstNode AST_GetRoot( Ast * ast );
+
+int AST_IsNull( AstNode node );
+
+int AST_GetNodeType( AstNode node );
+
+char * AST_GetNodeValue( AstNode node );
 
-int AST_GetNodeType( Ast * ast );
+int AST_GetNodeLine( AstNode node );
 
-char * AST_GetNodeValue( Ast * ast );
+Symbol * AST_GetNodeAnnotation( AstNode node );
 
-int AST_GetNodeLine( Ast * ast );
+void AST_Annotate( AstNode node, Symbol * sym );
 
-Symbol * AST_GetNodeAnnotation( Ast * ast );
+int AST_HasNext( AstNode node );
 
-void AST_Annotate( Ast * ast, Symbol * sym );
 
-int AST_HasNext( Ast * ast );
+AstNode AST_GetChild( AstNode node );
 
+AstNode AST_NextSibling( AstNode node );
 
-Ast * AST_GetChild( Ast * ast );
+int AST_GetTreeSize( AstNode node );
 
-Ast * AST_NextSibling( Ast * ast );
+AstNode AST_NextInOrder( AstNode node );
 
-char * AST_FindId( Ast * ast );
+char * AST_FindId( AstNode node );
 
-char * AST_FindType( Ast * ast, int * outPtr );
+char * AST_FindType( AstNode node, int * outPtr );
 
 #endif
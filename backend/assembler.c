@@ -4,6 +4,7 @@
 
 #include "assembler.h"
 #include "uthash.h"
+#include "../stats.h"
 
 #define N_REGS      6
 
@@ -11,14 +12,18 @@
 #define BB_START    1
 #define BB_END      2
 
+// Values a block remembers while it is optimized, the oldest are forgotten
+#define VN_WINDOW   32
+
 // Variables and registers hash
 typedef struct varhash VarHash;
 
 struct varhash
 {
     char * id;
-    char * value[32];
+    char ** value;      // Grows as the variable gets more values
     int size;	
+    int maxSize;
 	UT_hash_handle hh;
 };
 
@@ -70,10 +75,26 @@ void BBL_Dump( BasicBlock * bbl, Function * func, int blockNum )
     }
 }
 
+// Value held by a variable while a block is optimized: x = y op z, or a
+// copy x = y for OP_SET
+typedef struct value Value;
+
+struct value
+{
+    Opcode op;
+    Addr x;
+    Addr y;
+    Addr z;
+};
+
 struct assembler
 {
     VarHash * varStates;
     UsageHash * varUsages;
+    
+    // Reads left of each temp of the function, by number
+    int * tempUses;
+    int nTemps;
 };
 
 /*
@@ -85,6 +106,8 @@ Assembler * ASM_New()
     
     asm->varStates = NULL;
     asm->varUsages = NULL;
+    asm->tempUses = NULL;
+    asm->nTemps = 0;
     
     return asm;
 }
@@ -94,7 +117,22 @@ Destructor
 */
 void ASM_Delete( Assembler * asm )
 {
+    free( asm->tempUses );
+    free( asm );
+}
 
+/*
+Appends a value to a vars hash entry
+*/
+static void ASM_PushVarValue( VarHash * h, char * value )
+{
+    if( h->size == h->maxSize )
+    {
+        h->maxSize = h->maxSize ? 2 * h->maxSize : 4;
+        h->value = ( char** )realloc( h->value, h->maxSize * sizeof( char* ) );
+    }
+    
+    h->value[h->size++] = value;
 }
 
 /*
@@ -113,11 +151,11 @@ void ASM_AddVar( Assembler * asm, char * name )
     if( !h )
     {
 	    VarHash * h = ( VarHash* )malloc( sizeof( VarHash ) );
+	    STS_CountAlloc();
 	    h->id = strdup( name );
+	    h->value = NULL;
 	    h->size = 0;
-	    int i;
-	    for( i = 0; i < 32; i++ )
-    	    h->value[i] = NULL;
+	    h->maxSize = 0;
 	    
 	    HASH_ADD_STR( asm->varStates, id, h );
 	}
@@ -127,12 +165,14 @@ void ASM_AddVar( Assembler * asm, char * name )
 	    exit( EXIT_FAILURE );
 	}
 	
-	// Usages
-	HASH_FIND_STR( asm->varUsages, name, h );
+	// Usages, found through their own handle type
+	UsageHash * u;
+	HASH_FIND_STR( asm->varUsages, name, u );
         
-    if( !h )
+    if( !u )
     {
 	    UsageHash * h = ( UsageHash* )malloc( sizeof( UsageHash ) );
+	    STS_CountAlloc();
 	    h->id = strdup( name );
 	    h->value = 0;	    
 	
@@ -154,9 +194,12 @@ void ASM_SetVarValue( Assembler * asm, char * name, char * value )
         return; 
     
     VarHash * h = ( VarHash* )malloc( sizeof( VarHash ) );
+    STS_CountAlloc();
     VarHash * tmp;
     h->id = strdup( name ); 
+    h->value = NULL;
     h->size = 0;   
+    h->maxSize = 0;
     
     HASH_FIND_STR( asm->varStates, name, tmp );
         
@@ -164,7 +207,7 @@ void ASM_SetVarValue( Assembler * asm, char * name, char * value )
     {  
         if( value ) 
         {   
-            h->value[h->size++] = strdup( value );
+            ASM_PushVarValue( h, strdup( value ) );
         }        
         
         HASH_DEL( asm->varStates, tmp );	    
@@ -182,9 +225,12 @@ void ASM_AddVarValue( Assembler * asm, char * name, char * value )
         return; 
     
     VarHash * h = ( VarHash* )malloc( sizeof( VarHash ) );
+    STS_CountAlloc();
     VarHash * tmp;
     h->id = strdup( name );
+    h->value = NULL;
     h->size = 0;    
+    h->maxSize = 0;
     
     HASH_FIND_STR( asm->varStates, name, tmp );
         
@@ -193,10 +239,10 @@ void ASM_AddVarValue( Assembler * asm, char * name, char * value )
         int i;  
         for( i = 0; i < tmp->size; i++ )
         {
-            h->value[h->size++] = strdup( tmp->value[i] );            
+            ASM_PushVarValue( h, strdup( tmp->value[i] ) );
         }
         
-        h->value[h->size++] = strdup( value );
+        ASM_PushVarValue( h, strdup( value ) );
         
         HASH_DEL( asm->varStates, tmp );	    
     }   
@@ -217,7 +263,7 @@ int ASM_GetVarValues( Assembler * asm, char * name, char *** out )
         
     if( h )
     {	
-        *out = malloc( 32 * sizeof( char* ) );
+        *out = malloc( ( h->size + 1 ) * sizeof( char* ) );
         int i;
         for( i = 0; i < h->size; i++ )
         {
@@ -238,6 +284,7 @@ void ASM_SetVarUsage( Assembler * asm, char * name, int value )
         return;
         
     UsageHash * h = ( UsageHash* )malloc( sizeof( UsageHash ) );
+    STS_CountAlloc();
     UsageHash * tmp;
     h->id = strdup( name );
     h->value = value;
@@ -434,8 +481,8 @@ void ASM_UpdateOperation( Assembler * asm, char * regx, char * varx )
                         s->value[j] = s->value[j+1];
                     }
                     
-                    s->value[s->size] = NULL;
                     s->size--;
+                    s->value[s->size] = NULL;
                 }
             }
         }
@@ -1101,13 +1148,326 @@ void ASM_SetupVarsLiveness( Assembler * asm, Instr * start, Instr * end, int dep
     ASM_SetVarLiveness( asm, &(start->z), z, depth );
 }
 
+static int isVariable( Addr a )
+{
+    return a.type == AD_TEMP || a.type == AD_LOCAL || a.type == AD_GLOBAL;
+}
+
+static int isPure( Opcode op )
+{
+    switch( op )
+    {
+        case OP_NE:
+        case OP_EQ:
+        case OP_LT:
+        case OP_GT:
+        case OP_LE:
+        case OP_GE:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_DIV:
+        case OP_MUL:
+        case OP_NEG:
+            return 1;
+            
+        default:
+            return 0;
+    }
+}
+
+static int isCommutative( Opcode op )
+{
+    return op == OP_NE || op == OP_EQ || op == OP_ADD || op == OP_MUL;
+}
+
+/*
+Tells whether the instruction writes its x address
+*/
+static int writesX( Instr * ins )
+{
+    return ins->op == OP_SET || ins->op == OP_SET_BYTE || ins->op == OP_SET_IDX || ins->op == OP_SET_IDX_BYTE ||
+           ins->op == OP_NEW || ins->op == OP_NEW_BYTE || isPure( ins->op );
+}
+
+/*
+Returns the addresses the instruction reads, at most three
+*/
+static int readAddresses( Instr * ins, Addr ** reads )
+{
+    switch( ins->op )
+    {
+        case OP_PARAM:
+        case OP_RET_VAL:
+        case OP_IF:
+        case OP_IF_FALSE:
+            reads[0] = &ins->x;
+            return 1;
+            
+        case OP_SET:
+        case OP_SET_BYTE:
+        case OP_NEG:
+        case OP_NEW:
+        case OP_NEW_BYTE:
+            reads[0] = &ins->y;
+            return 1;
+            
+        case OP_IDX_SET:
+        case OP_IDX_SET_BYTE:
+            reads[0] = &ins->x;
+            reads[1] = &ins->y;
+            reads[2] = &ins->z;
+            return 3;
+            
+        case OP_LABEL:
+        case OP_GOTO:
+        case OP_CALL:
+        case OP_RET:
+            return 0;
+            
+        default:
+            reads[0] = &ins->y;
+            reads[1] = &ins->z;
+            return 2;
+    }
+}
+
+static int * ASM_TempUses( Assembler * asm, Addr a )
+{
+    if( a.type != AD_TEMP || a.num < 0 || a.num >= asm->nTemps )
+        return NULL;
+        
+    return &asm->tempUses[a.num];
+}
+
+static void ASM_AddTempUses( Assembler * asm, Addr a, int n )
+{
+    int * uses = ASM_TempUses( asm, a );
+    
+    if( uses )
+        *uses += n;
+}
+
+/*
+Counts the reads of every temp of the function, so that the blocks know
+which temps no other block needs
+*/
+void ASM_CountTempUses( Assembler * asm, Function * func )
+{
+    Variable * it;
+    Instr * ins;
+    Addr * reads[3];
+    int i, n;
+    
+    asm->nTemps = 0;
+    for( it = func->temps; it; it = it->next )
+        asm->nTemps++;
+        
+    free( asm->tempUses );
+    asm->tempUses = ( int* )calloc( asm->nTemps + 1, sizeof( int ) );
+    
+    for( ins = func->code; ins; ins = ins->next )
+    {
+        n = readAddresses( ins, reads );
+        
+        for( i = 0; i < n; i++ )
+            ASM_AddTempUses( asm, *reads[i], 1 );
+    }
+}
+
+static void forgetValue( Value * values, int * nValues, int i )
+{
+    memmove( &values[i], &values[i+1], ( *nValues - i - 1 ) * sizeof( Value ) );
+    ( *nValues )--;
+}
+
+static void rememberValue( Value * values, int * nValues, Instr * ins )
+{
+    if( *nValues == VN_WINDOW )
+        forgetValue( values, nValues, 0 );
+        
+    values[*nValues].op = ins->op;
+    values[*nValues].x = ins->x;
+    values[*nValues].y = ins->y;
+    values[*nValues].z = ins->z;
+    ( *nValues )++;
+}
+
+/*
+Forgets the values held by or computed from a variable being written
+*/
+static void forgetVariable( Value * values, int * nValues, Addr var )
+{
+    int i = 0;
+    
+    while( i < *nValues )
+    {
+        if( Addr_eq( values[i].x, var ) || Addr_eq( values[i].y, var ) || Addr_eq( values[i].z, var ) )
+            forgetValue( values, nValues, i );
+        else
+            i++;
+    }
+}
+
+static int isClobberedByCall( Addr a )
+{
+    return a.type == AD_GLOBAL || ( a.type == AD_TEMP && strcmp( a.str, "$ret" ) == 0 );
+}
+
+/*
+A call may write any global, and writes $ret
+*/
+static void forgetCall( Value * values, int * nValues )
+{
+    int i = 0;
+    
+    while( i < *nValues )
+    {
+        if( isClobberedByCall( values[i].x ) || isClobberedByCall( values[i].y ) || isClobberedByCall( values[i].z ) )
+            forgetValue( values, nValues, i );
+        else
+            i++;
+    }
+}
+
+/*
+Local value numbering of a block. Reads of a copy x = y read y instead,
+an operation whose (op, y, z) a variable still holds becomes a copy of
+that variable, and then copies and operations into temps nothing reads
+any more are removed. link points to the pointer to the block's start.
+*/
+void ASM_OptimizeBlock( Assembler * asm, BasicBlock * bbl, Instr ** link )
+{
+    Value values[VN_WINDOW];
+    int nValues = 0;
+    Instr * after = bbl->end->next;
+    Instr ** code = ( Instr** )malloc( bbl->size * sizeof( Instr* ) );
+    Instr * ins;
+    Addr * reads[3];
+    int size = 0;
+    int i, j, n;
+    
+    for( ins = bbl->start; ins != after; ins = ins->next )
+        code[size++] = ins;
+    
+    for( i = 0; i < size; i++ )
+    {
+        ins = code[i];
+        n = readAddresses( ins, reads );
+        
+        // Copy propagation
+        for( j = 0; j < n; j++ )
+        {
+            int k;
+            
+            if( !isVariable( *reads[j] ) )
+                continue;
+                
+            for( k = 0; k < nValues; k++ )
+            {
+                if( values[k].op == OP_SET && Addr_eq( values[k].x, *reads[j] ) )
+                {
+                    ASM_AddTempUses( asm, *reads[j], -1 );
+                    ASM_AddTempUses( asm, values[k].y, 1 );
+                    *reads[j] = values[k].y;
+                    break;
+                }
+            }
+        }
+        
+        // Common subexpressions
+        if( isPure( ins->op ) )
+        {
+            for( j = 0; j < nValues; j++ )
+            {
+                Value * v = &values[j];
+                
+                if( v->op != ins->op )
+                    continue;
+                    
+                if( ( Addr_eq( v->y, ins->y ) && ( ins->op == OP_NEG || Addr_eq( v->z, ins->z ) ) ) ||
+                    ( isCommutative( ins->op ) && Addr_eq( v->y, ins->z ) && Addr_eq( v->z, ins->y ) ) )
+                {
+                    ASM_AddTempUses( asm, ins->y, -1 );
+                    ASM_AddTempUses( asm, ins->z, -1 );
+                    ASM_AddTempUses( asm, v->x, 1 );
+                    ins->op = OP_SET;
+                    ins->y = v->x;
+                    memset( &ins->z, 0, sizeof( Addr ) );
+                    break;
+                }
+            }
+        }
+        
+        if( ins->op == OP_CALL )
+            forgetCall( values, &nValues );
+        
+        if( !writesX( ins ) )
+            continue;
+            
+        forgetVariable( values, &nValues, ins->x );
+        
+        if( ins->op == OP_SET && isVariable( ins->y ) && !Addr_eq( ins->x, ins->y ) )
+            rememberValue( values, &nValues, ins );
+        else if( isPure( ins->op ) && !Addr_eq( ins->x, ins->y ) && !Addr_eq( ins->x, ins->z ) )
+            rememberValue( values, &nValues, ins );
+    }
+    
+    // Dead temps, last first so that removing a read can free another
+    for( i = size - 1; i >= 0; i-- )
+    {
+        int * uses;
+        
+        ins = code[i];
+        
+        if( ins->op != OP_SET && !isPure( ins->op ) )
+            continue;
+            
+        uses = ASM_TempUses( asm, ins->x );
+        
+        if( !uses || *uses > 0 || strcmp( ins->x.str, "$ret" ) == 0 )
+            continue;
+            
+        n = readAddresses( ins, reads );
+        for( j = 0; j < n; j++ )
+            ASM_AddTempUses( asm, *reads[j], -1 );
+        
+        // Only unlinked, IR_load allocates a function's code as one array
+        code[i] = NULL;
+    }
+    
+    bbl->size = 0;
+    bbl->start = NULL;
+    bbl->end = NULL;
+    
+    for( i = 0; i < size; i++ )
+    {
+        if( !code[i] )
+            continue;
+            
+        *link = code[i];
+        link = &code[i]->next;
+        
+        if( !bbl->start )
+            bbl->start = code[i];
+            
+        bbl->end = code[i];
+        bbl->size++;
+    }
+    
+    *link = after;
+    free( code );
+}
+
 /*
 Builds given function's basic blocks
 */
 void ASM_BuildBlocks( Assembler * asm, Function * func )
 {
     int loop = 0;
+    int nBlocks = 0;
+    int nRemoved = 0;
     BasicBlock * bbl = BBL_New();
+    Instr ** link = &func->code;
     
     printf( ".%s:\n", func->name );
     printf( "\tpushl %%ebp\n" );
@@ -1116,8 +1476,20 @@ void ASM_BuildBlocks( Assembler * asm, Function * func )
     do
     {        
         loop = ASM_NextBasicBlock( asm, func, bbl );
+        
+        int size = bbl->size;
+        ASM_OptimizeBlock( asm, bbl, link );
+        nRemoved += size - bbl->size;
+        
+        // Every instruction of the block may have been removed
+        if( !bbl->start )
+            continue;
+        
+        link = &bbl->end->next;
                 
         ASM_SetupVarsLiveness( asm, bbl->start, bbl->end, 1 );        
+        nBlocks++;
+        
         ASM_GenerateCode( asm, bbl );
         ASM_ClearHashes( asm ); 
         //BBL_Dump( bbl, func, blockNum++ );
@@ -1127,6 +1499,10 @@ void ASM_BuildBlocks( Assembler * asm, Function * func )
     printf( "\tmovl %%ebp, %%esp\n" );    
     printf( "\tpopl %%ebp\n" );
     printf( "\tret\n" );    
+    
+    STS_Count( "codegen", "functions", 1 );
+    STS_Count( "codegen", "blocks", nBlocks );
+    STS_Count( "codegen", "removed instrs", nRemoved );
 }
 
 /*
@@ -1154,14 +1530,21 @@ void ASM_Build( Assembler * asm, IR * ir, char * filepath )
         func = func->next;
     }
     
+    // Blocks are split, optimized and assembled one after the other, so
+    // that is one phase, begun once
+    STS_Begin( "codegen" );
+    
     func = ir->functions;
     while( func )
     {
         //ASM_ClearHashes( asm );
         ASM_SetupHashes( asm, func );
+        ASM_CountTempUses( asm, func );
         ASM_BuildBlocks( asm, func );
         func = func->next;
     }
     
+    STS_End( "codegen" );
+    
     fclose( fp );
 }
@@ -5,6 +5,6 @@ typedef struct assembler Assembler;
 
 Assembler * ASM_New();
 
-void ASM_Delete( Assembler * asm );
+void ASM_Delete( Assembler * assembler );
 
-void ASM_Build( Assembler * asm, IR * ir, char * filepath );
+void ASM_Build( Assembler * assembler, IR * ir, char * filepath );
@@ -1,10 +1,17 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "ir.h"
+#include "uthash.h"
+#include "../stats.h"
 
 // -------------------- List --------------------
 
@@ -31,6 +38,7 @@ Allocate a new string entry.
 */
 String* String_new(char* name, char* value) {
 	String* str = calloc(1, sizeof(String));
+	STS_CountAlloc();
 	str->name = name;
 	str->value = value;
 	return str;
@@ -44,6 +52,7 @@ Lists of variables are used for globals, locals and temps.
 */
 Variable* Variable_new(char* name) {
 	Variable* var = calloc(1, sizeof(Variable));
+	STS_CountAlloc();
 	var->name = name;
 	return var;
 }
@@ -176,7 +185,7 @@ Use this function to compare two Addrs.
 This way no string comparison is necessary.
 */
 bool Addr_eq(Addr a1, Addr a2) {
-	return (a1.type == a1.type && a1.num == a1.num);
+	return (a1.type == a2.type && a1.num == a2.num);
 }
 
 // -------------------- Instr --------------------
@@ -190,6 +199,7 @@ Instr* Instr_new(Opcode op, ...) {
 	va_list ap;
 	va_start(ap, op);
 	Instr* ins = calloc(1, sizeof(Instr));
+	STS_CountAlloc();
 	ins->op = op;
 	switch (op) {
 		// instructions with x only
@@ -294,6 +304,7 @@ Allocate a new function, with a given name and a given set of arguments.
 */
 Function* Function_new(char* name, Variable* args) {
 	Function* fun = calloc(1, sizeof(Function));
+	STS_CountAlloc();
 	fun->name = name;
 	fun->locals = args;
 	int nArgs = 0;
@@ -330,6 +341,7 @@ Allocate a new IR data structure.
 */
 IR* IR_new() {
 	IR* ir = calloc(1, sizeof(IR));
+	STS_CountAlloc();
 	return ir;
 }
 
@@ -381,3 +393,359 @@ void IR_dump(IR* ir, FILE* fd) {
 	}
 }
 
+// -------------------- Binary IR --------------------
+
+/*
+Layout of a binary IR file. Every field is a 32-bit int and every string
+is an offset into the string table (-1 for none), so that a mapped file
+is read in place:
+
+	magic, version, size of the string table, the table (padded to 4 bytes),
+	number of strings and a (name, value) pair for each,
+	number of globals and the name of each,
+	number of functions and, for each, its name, nArgs, number of locals,
+	number of temps, number of instructions, the names of its locals,
+	the names of its temps and an InstrRecord per instruction.
+*/
+#define IR_MAGIC   0x52493024	/* "$0IR" */
+#define IR_VERSION 1
+
+typedef struct AddrRecord_ {
+	int32_t type;
+	int32_t num;
+	int32_t str;
+} AddrRecord;
+
+typedef struct InstrRecord_ {
+	int32_t op;
+	AddrRecord x;
+	AddrRecord y;
+	AddrRecord z;
+} InstrRecord;
+
+/*
+Strings being written, each once.
+*/
+typedef struct StringEntry_ {
+	const char* str;
+	int32_t offset;
+	UT_hash_handle hh;
+} StringEntry;
+
+typedef struct StringTable_ {
+	StringEntry* entries;
+	char* data;
+	int32_t size;
+	int32_t maxSize;
+} StringTable;
+
+/*
+Offset of str in the table, adding it if it is new.
+*/
+static int32_t StringTable_add(StringTable* table, const char* str) {
+	if (!str) {
+		return -1;
+	}
+	StringEntry* e;
+	HASH_FIND_STR(table->entries, str, e);
+	if (e) {
+		return e->offset;
+	}
+	int32_t length = strlen(str) + 1;
+	if (table->size + length > table->maxSize) {
+		while (table->size + length > table->maxSize) {
+			table->maxSize = table->maxSize ? 2 * table->maxSize : 4096;
+		}
+		table->data = realloc(table->data, table->maxSize);
+	}
+	memcpy(table->data + table->size, str, length);
+	e = malloc(sizeof(StringEntry));
+	e->str = str;
+	e->offset = table->size;
+	HASH_ADD_KEYPTR(hh, table->entries, e->str, length - 1, e);
+	table->size += length;
+	return e->offset;
+}
+
+static void StringTable_free(StringTable* table) {
+	StringEntry* e;
+	StringEntry* tmp;
+	HASH_ITER(hh, table->entries, e, tmp) {
+		HASH_DEL(table->entries, e);
+		free(e);
+	}
+	free(table->data);
+}
+
+static int32_t List_length(List* list) {
+	int32_t n = 0;
+	for (; list; list = list->next) {
+		n++;
+	}
+	return n;
+}
+
+static void writeInt(FILE* fd, int32_t value) {
+	fwrite(&value, sizeof(int32_t), 1, fd);
+}
+
+static void writeNames(FILE* fd, StringTable* table, Variable* vars) {
+	for (Variable* v = vars; v; v = v->next) {
+		writeInt(fd, StringTable_add(table, v->name));
+	}
+}
+
+static AddrRecord Addr_record(Addr addr, StringTable* table) {
+	AddrRecord record;
+	record.type = addr.type;
+	record.num = addr.num;
+	record.str = StringTable_add(table, addr.str);
+	return record;
+}
+
+/*
+Adds every string of the IR to the table, in the order they are written.
+*/
+static void IR_collectStrings(IR* ir, StringTable* table) {
+	for (String* s = ir->strings; s; s = s->next) {
+		StringTable_add(table, s->name);
+		StringTable_add(table, s->value);
+	}
+	for (Variable* v = ir->globals; v; v = v->next) {
+		StringTable_add(table, v->name);
+	}
+	for (Function* fun = ir->functions; fun; fun = fun->next) {
+		StringTable_add(table, fun->name);
+		for (Variable* v = fun->locals; v; v = v->next) {
+			StringTable_add(table, v->name);
+		}
+		for (Variable* v = fun->temps; v; v = v->next) {
+			StringTable_add(table, v->name);
+		}
+		for (Instr* ins = fun->code; ins; ins = ins->next) {
+			StringTable_add(table, ins->x.str);
+			StringTable_add(table, ins->y.str);
+			StringTable_add(table, ins->z.str);
+		}
+	}
+}
+
+/*
+Write the IR to path in the binary format read by IR_load.
+Returns false if the file could not be written.
+*/
+bool IR_save(IR* ir, const char* path) {
+	FILE* fd = fopen(path, "wb");
+	if (!fd) {
+		return false;
+	}
+	StringTable table;
+	memset(&table, 0, sizeof(StringTable));
+	IR_collectStrings(ir, &table);
+	int32_t padding = (4 - table.size % 4) % 4;
+	writeInt(fd, IR_MAGIC);
+	writeInt(fd, IR_VERSION);
+	writeInt(fd, table.size + padding);
+	fwrite(table.data, 1, table.size, fd);
+	fwrite("\0\0\0", 1, padding, fd);
+	writeInt(fd, List_length((List*) ir->strings));
+	for (String* s = ir->strings; s; s = s->next) {
+		writeInt(fd, StringTable_add(&table, s->name));
+		writeInt(fd, StringTable_add(&table, s->value));
+	}
+	writeInt(fd, List_length((List*) ir->globals));
+	writeNames(fd, &table, ir->globals);
+	writeInt(fd, List_length((List*) ir->functions));
+	for (Function* fun = ir->functions; fun; fun = fun->next) {
+		writeInt(fd, StringTable_add(&table, fun->name));
+		writeInt(fd, fun->nArgs);
+		writeInt(fd, List_length((List*) fun->locals));
+		writeInt(fd, List_length((List*) fun->temps));
+		writeInt(fd, List_length((List*) fun->code));
+		writeNames(fd, &table, fun->locals);
+		writeNames(fd, &table, fun->temps);
+		for (Instr* ins = fun->code; ins; ins = ins->next) {
+			InstrRecord record;
+			record.op = ins->op;
+			record.x = Addr_record(ins->x, &table);
+			record.y = Addr_record(ins->y, &table);
+			record.z = Addr_record(ins->z, &table);
+			fwrite(&record, sizeof(InstrRecord), 1, fd);
+		}
+	}
+	StringTable_free(&table);
+	return fclose(fd) == 0;
+}
+
+/*
+A mapped binary IR being read.
+*/
+typedef struct Reader_ {
+	const char* path;
+	const int32_t* curr;
+	const int32_t* end;
+	const char* strings;
+	int32_t stringsSize;
+} Reader;
+
+static void Reader_corrupt(Reader* r) {
+	fprintf(stderr, "Corrupt binary IR file '%s'.\n", r->path);
+	exit(1);
+}
+
+/*
+Claim the next n ints of the file.
+*/
+static const int32_t* Reader_take(Reader* r, int32_t n) {
+	if (n < 0 || r->end - r->curr < n) {
+		Reader_corrupt(r);
+	}
+	const int32_t* data = r->curr;
+	r->curr += n;
+	return data;
+}
+
+static int32_t Reader_int(Reader* r) {
+	return *Reader_take(r, 1);
+}
+
+static char* Reader_string(Reader* r, int32_t offset) {
+	if (offset == -1) {
+		return NULL;
+	}
+	if (offset < 0 || offset >= r->stringsSize) {
+		Reader_corrupt(r);
+	}
+	return (char*) r->strings + offset;
+}
+
+/*
+Read n names into a list of variables, allocated at once.
+*/
+static Variable* Reader_variables(Reader* r, int32_t n) {
+	const int32_t* names = Reader_take(r, n);
+	if (n == 0) {
+		return NULL;
+	}
+	Variable* vars = calloc(n, sizeof(Variable));
+	STS_CountAlloc();
+	for (int32_t i = 0; i < n; i++) {
+		vars[i].name = Reader_string(r, names[i]);
+		vars[i].next = (i + 1 < n) ? &vars[i + 1] : NULL;
+	}
+	return vars;
+}
+
+static Addr Reader_addr(Reader* r, AddrRecord record) {
+	Addr addr;
+	if (record.type < AD_UNSET || record.type > AD_FUNCTION) {
+		Reader_corrupt(r);
+	}
+	addr.type = record.type;
+	addr.num = record.num;
+	addr.str = Reader_string(r, record.str);
+	addr.nextUsage = -1;
+	return addr;
+}
+
+static Function* Reader_function(Reader* r) {
+	Function* fun = calloc(1, sizeof(Function));
+	STS_CountAlloc();
+	fun->name = Reader_string(r, Reader_int(r));
+	fun->nArgs = Reader_int(r);
+	int32_t nLocals = Reader_int(r);
+	int32_t nTemps = Reader_int(r);
+	int32_t nInstrs = Reader_int(r);
+	fun->locals = Reader_variables(r, nLocals);
+	fun->temps = Reader_variables(r, nTemps);
+	if (nInstrs < 0 || (size_t) (r->end - r->curr) / (sizeof(InstrRecord) / sizeof(int32_t)) < (size_t) nInstrs) {
+		Reader_corrupt(r);
+	}
+	const InstrRecord* records = (const InstrRecord*) Reader_take(r, nInstrs * (sizeof(InstrRecord) / sizeof(int32_t)));
+	if (nInstrs == 0) {
+		return fun;
+	}
+	Instr* code = calloc(nInstrs, sizeof(Instr));
+	STS_CountAlloc();
+	for (int32_t i = 0; i < nInstrs; i++) {
+		if (records[i].op < OP_LABEL || records[i].op > OP_NEW_BYTE) {
+			Reader_corrupt(r);
+		}
+		code[i].op = records[i].op;
+		code[i].x = Reader_addr(r, records[i].x);
+		code[i].y = Reader_addr(r, records[i].y);
+		code[i].z = Reader_addr(r, records[i].z);
+		code[i].next = (i + 1 < nInstrs) ? &code[i + 1] : NULL;
+	}
+	fun->code = code;
+	return fun;
+}
+
+/*
+Map a file written by IR_save. Strings of the IR point into the mapping,
+which is kept for the rest of the program; only the lists are built.
+Returns NULL if path is not a binary IR file.
+*/
+IR* IR_load(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < 3 * (off_t) sizeof(int32_t) || st.st_size % sizeof(int32_t) != 0) {
+		close(fd);
+		return NULL;
+	}
+	const int32_t* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+	if (data[0] != IR_MAGIC) {
+		munmap((void*) data, st.st_size);
+		return NULL;
+	}
+	Reader r;
+	r.path = path;
+	r.curr = data + 1;
+	r.end = data + st.st_size / sizeof(int32_t);
+	if (Reader_int(&r) != IR_VERSION) {
+		fprintf(stderr, "Binary IR file '%s' is of another version.\n", path);
+		exit(1);
+	}
+	r.stringsSize = Reader_int(&r);
+	if (r.stringsSize % sizeof(int32_t) != 0) {
+		Reader_corrupt(&r);
+	}
+	r.strings = (const char*) Reader_take(&r, r.stringsSize / sizeof(int32_t));
+	if (r.stringsSize > 0 && r.strings[r.stringsSize - 1] != '\0') {
+		Reader_corrupt(&r);
+	}
+	IR* ir = IR_new();
+	int32_t nStrings = Reader_int(&r);
+	const int32_t* pairs = Reader_take(&r, nStrings < 0 ? -1 : 2 * nStrings);
+	if (nStrings > 0) {
+		String* strs = calloc(nStrings, sizeof(String));
+		STS_CountAlloc();
+		for (int32_t i = 0; i < nStrings; i++) {
+			strs[i].name = Reader_string(&r, pairs[2 * i]);
+			strs[i].value = Reader_string(&r, pairs[2 * i + 1]);
+			strs[i].next = (i + 1 < nStrings) ? &strs[i + 1] : NULL;
+		}
+		ir->strings = strs;
+	}
+	ir->globals = Reader_variables(&r, Reader_int(&r));
+	int32_t nFunctions = Reader_int(&r);
+	Function* last = NULL;
+	for (int32_t i = 0; i < nFunctions; i++) {
+		Function* fun = Reader_function(&r);
+		if (last) {
+			last->next = fun;
+		} else {
+			ir->functions = fun;
+		}
+		last = fun;
+	}
+	return ir;
+}
+
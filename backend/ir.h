@@ -2,6 +2,7 @@
 #ifndef IR_H
 #define IR_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
 /*
@@ -172,6 +173,8 @@ void IR_setStrings(IR* ir, String* strings);
 void IR_setGlobals(IR* ir, Variable* globals);
 void IR_addFunction(IR* ir, Function* fun);
 void IR_dump(IR* ir, FILE* fd);
+bool IR_save(IR* ir, const char* path);
+IR* IR_load(const char* path);
 
 String* String_new(char* name, char* value);
 #define String_link(_l1, _l2) ((String*)List_link((List*)(_l1), (List*)(_l2)))
@@ -188,6 +191,7 @@ Addr Addr_litNum(int num);
 Addr Addr_label(char* label);
 Addr Addr_function(char* name);
 Addr Addr_resolve(char* name, IR* ir, Function* fun);
+bool Addr_eq(Addr a1, Addr a2);
 
 Function* Function_new(char* name, Variable* args);
 
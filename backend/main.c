@@ -1,9 +1,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ir.h"
 #include "assembler.h"
+#include "../stats.h"
 
 extern FILE* yyin;
 extern int yyparse();
@@ -11,26 +13,67 @@ extern int yydebug;
 
 extern IR* ir;
 
+/*
+Number of instructions in all functions of the program.
+*/
+static long countInstrs(IR* ir) {
+	long n = 0;
+	Function* fun;
+	Instr* ins;
+	for (fun = ir->functions; fun; fun = fun->next) {
+		for (ins = fun->code; ins; ins = ins->next) {
+			n++;
+		}
+	}
+	return n;
+}
+
 int main(int argc, char** argv) {
 	int err;
+	char* path = NULL;
 	//yydebug = 1;
-	if (argc < 2) {
-		fprintf(stderr, "Uso: %s arquivo.m0.ir\n", argv[0]);
-		exit(1);
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--stats") == 0) {
+			STS_Enable();
+		} else {
+			path = argv[i];
+		}
 	}
-	yyin = fopen(argv[1], "r");
-	err = yyparse();
-	fclose(yyin);
-	if (err != 0) {
-		fprintf(stderr, "Error reading input file.\n");
+	if (!path) {
+		fprintf(stderr, "Uso: %s [--stats] arquivo.m0.ir|arquivo.m0.irb\n", argv[0]);
 		exit(1);
 	}
+	// A binary IR is mapped as it is, text goes through the parser
+	STS_Begin("ir load");
+	IR* binary = IR_load(path);
+	STS_End("ir load");
+	if (binary) {
+		ir = binary;
+	} else {
+		STS_Begin("ir parse");
+		yyin = fopen(path, "r");
+		err = yyparse();
+		fclose(yyin);
+		STS_End("ir parse");
+		if (err != 0) {
+			fprintf(stderr, "Error reading input file.\n");
+			exit(1);
+		}
+	}
+	if (STS_IsEnabled()) {
+		STS_Count(binary ? "ir load" : "ir parse", "instrs", countInstrs(ir));
+	}
 	
-	char filepath[100];
-	sprintf( filepath, "%s.s", argv[1] );
+	size_t size = strlen( path ) + 3;
+	char* filepath = malloc( size );
+	snprintf( filepath, size, "%s.s", path );
 	
 	Assembler * asm = ASM_New();
 	ASM_Build( asm, ir, filepath );
+	ASM_Delete( asm );
+	free( filepath );
+	
+	STS_Report();
 	
 	return 0;
 }
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "stats.h"
+
+// Bumped whenever a section's layout or what a phase stores in it changes,
+// so records of an older compiler are never read
+#define CCH_VERSION 5
+
+static const char magic[8] = "M0CACHE";
+
+typedef struct record Record;
+
+struct record
+{
+    unsigned long long key;
+    char * data[CCH_SECTIONS];
+    int size[CCH_SECTIONS];
+    int maxSize[CCH_SECTIONS];  // 0 while data points into the loaded file
+};
+
+typedef struct function Function;
+
+struct function
+{
+    Record * record;    // The loaded one on a hit, else the one being written
+    int hit;
+    int cursor[CCH_SECTIONS];
+};
+
+// Loaded records are found through open addressing on their key, never
+// more than half full. Functions are only written by the thread that
+// looked them up, so several functions can be handled at once.
+struct cache
+{
+    char * file;
+    Record * loaded;
+    int nLoaded;
+    Record ** table;
+    unsigned nSlots;
+    Function * functions;
+    int nFunctions;
+    int nHits;
+};
+
+unsigned long long CCH_Hash( unsigned long long hash, const void * data, size_t size )
+{
+    const unsigned char * bytes = ( const unsigned char* )data;
+    size_t i;
+
+    for( i = 0; i < size; i++ )
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static Record ** CCH_Probe( Cache * cache, unsigned long long key )
+{
+    unsigned i = ( unsigned )( key ^ ( key >> 32 ) ) & ( cache->nSlots - 1 );
+
+    while( cache->table[i] && cache->table[i]->key != key )
+        i = ( i + 1 ) & ( cache->nSlots - 1 );
+
+    return &cache->table[i];
+}
+
+// Reads the records of file, size bytes long. Returns 0 if it is not a
+// whole cache of this version.
+static int CCH_Parse( Cache * cache, char * file, long size )
+{
+    char * curr = file;
+    char * end = file + size;
+    int version;
+    int nRecords;
+    int i;
+    int j;
+
+    if( size < ( long )( sizeof( magic ) + 2 * sizeof( int ) ) || memcmp( curr, magic, sizeof( magic ) ) != 0 )
+        return 0;
+
+    curr += sizeof( magic );
+    memcpy( &version, curr, sizeof( int ) );
+    curr += sizeof( int );
+    memcpy( &nRecords, curr, sizeof( int ) );
+    curr += sizeof( int );
+
+    if( version != CCH_VERSION || nRecords < 0 )
+        return 0;
+
+    cache->loaded = ( Record* )calloc( nRecords + 1, sizeof( Record ) );
+
+    for( i = 0; i < nRecords; i++ )
+    {
+        Record * record = &cache->loaded[i];
+
+        if( end - curr < ( long )sizeof( record->key ) )
+            return 0;
+
+        memcpy( &record->key, curr, sizeof( record->key ) );
+        curr += sizeof( record->key );
+
+        for( j = 0; j < CCH_SECTIONS; j++ )
+        {
+            if( end - curr < ( long )sizeof( int ) )
+                return 0;
+
+            memcpy( &record->size[j], curr, sizeof( int ) );
+            curr += sizeof( int );
+
+            if( record->size[j] < 0 || end - curr < record->size[j] )
+                return 0;
+
+            record->data[j] = curr;
+            curr += record->size[j];
+        }
+    }
+
+    cache->nLoaded = nRecords;
+
+    return 1;
+}
+
+// A cache holding nothing when path can't be read or holds no cache of
+// this version, as on a first run
+Cache * CCH_Load( char * path )
+{
+    Cache * cache = ( Cache* )calloc( 1, sizeof( Cache ) );
+    FILE * fp = fopen( path, "rb" );
+    int i;
+
+    if( fp )
+    {
+        long size;
+
+        fseek( fp, 0, SEEK_END );
+        size = ftell( fp );
+        fseek( fp, 0, SEEK_SET );
+
+        cache->file = ( char* )malloc( size > 0 ? size : 1 );
+
+        if( size <= 0 || fread( cache->file, 1, size, fp ) != ( size_t )size || !CCH_Parse( cache, cache->file, size ) )
+            cache->nLoaded = 0;
+
+        fclose( fp );
+    }
+
+    cache->nSlots = 16;
+
+    while( cache->nSlots < 2 * ( unsigned )cache->nLoaded )
+        cache->nSlots *= 2;
+
+    cache->table = ( Record** )calloc( cache->nSlots, sizeof( Record* ) );
+
+    for( i = 0; i < cache->nLoaded; i++ )
+        *CCH_Probe( cache, cache->loaded[i].key ) = &cache->loaded[i];
+
+    return cache;
+}
+
+void CCH_Delete( Cache * cache )
+{
+    int i;
+    int j;
+
+    for( i = 0; i < cache->nFunctions; i++ )
+    {
+        Function * function = &cache->functions[i];
+
+        if( function->record && !function->hit )
+        {
+            for( j = 0; j < CCH_SECTIONS; j++ )
+                free( function->record->data[j] );
+
+            free( function->record );
+        }
+    }
+
+    free( cache->functions );
+    free( cache->table );
+    free( cache->loaded );
+    free( cache->file );
+    free( cache );
+}
+
+// Keeps only the records of this compilation. Written aside and renamed,
+// so an interrupted run leaves the previous cache whole.
+void CCH_Save( Cache * cache, char * path )
+{
+    char * tempPath = ( char* )malloc( strlen( path ) + 5 );
+    int version = CCH_VERSION;
+    int nRecords = 0;
+    int i;
+    int j;
+
+    sprintf( tempPath, "%s.tmp", path );
+
+    FILE * fp = fopen( tempPath, "wb" );
+    if( !fp )
+    {
+        fprintf( stderr, "!Cache Error: Could not write \'%s\'.\n", tempPath );
+        free( tempPath );
+        return;
+    }
+
+    for( i = 0; i < cache->nFunctions; i++ )
+    {
+        if( cache->functions[i].record )
+            nRecords++;
+    }
+
+    fwrite( magic, sizeof( magic ), 1, fp );
+    fwrite( &version, sizeof( int ), 1, fp );
+    fwrite( &nRecords, sizeof( int ), 1, fp );
+
+    for( i = 0; i < cache->nFunctions; i++ )
+    {
+        Record * record = cache->functions[i].record;
+
+        if( !record )
+            continue;
+
+        fwrite( &record->key, sizeof( record->key ), 1, fp );
+
+        for( j = 0; j < CCH_SECTIONS; j++ )
+        {
+            fwrite( &record->size[j], sizeof( int ), 1, fp );
+            fwrite( record->data[j], 1, record->size[j], fp );
+        }
+    }
+
+    if( fclose( fp ) != 0 || rename( tempPath, path ) != 0 )
+        fprintf( stderr, "!Cache Error: Could not write \'%s\'.\n", path );
+
+    free( tempPath );
+}
+
+// Must cover every function before they are looked up on several threads
+void CCH_Reserve( Cache * cache, int nFunctions )
+{
+    if( nFunctions <= cache->nFunctions )
+        return;
+
+    cache->functions = ( Function* )realloc( cache->functions, nFunctions * sizeof( Function ) );
+    memset( &cache->functions[cache->nFunctions], 0, ( nFunctions - cache->nFunctions ) * sizeof( Function ) );
+    cache->nFunctions = nFunctions;
+}
+
+// Returns 1 and gives function the loaded record of key if there is one.
+// Otherwise function gets an empty record for its phases to fill.
+int CCH_Lookup( Cache * cache, int function, unsigned long long key )
+{
+    Function * f = &cache->functions[function];
+    Record * record = *CCH_Probe( cache, key );
+
+    if( record )
+    {
+        f->record = record;
+        f->hit = 1;
+        __atomic_fetch_add( &cache->nHits, 1, __ATOMIC_RELAXED );
+
+        return 1;
+    }
+
+    f->record = ( Record* )calloc( 1, sizeof( Record ) );
+    STS_CountAlloc();
+    f->record->key = key;
+
+    return 0;
+}
+
+int CCH_IsHit( Cache * cache, int function )
+{
+    return ( function < cache->nFunctions && cache->functions[function].hit );
+}
+
+int CCH_GetHitCount( Cache * cache )
+{
+    return cache->nHits;
+}
+
+/********************************************************************/
+
+static void CCH_Put( Cache * cache, int function, int section, const void * data, int size )
+{
+    Record * record = cache->functions[function].record;
+
+    if( record->size[section] + size > record->maxSize[section] )
+    {
+        int maxSize = record->maxSize[section] ? record->maxSize[section] : 64;
+
+        while( record->size[section] + size > maxSize )
+            maxSize *= 2;
+
+        record->data[section] = ( char* )realloc( record->data[section], maxSize );
+        record->maxSize[section] = maxSize;
+    }
+
+    memcpy( record->data[section] + record->size[section], data, size );
+    record->size[section] += size;
+}
+
+static char * CCH_Get( Cache * cache, int function, int section, int size )
+{
+    Function * f = &cache->functions[function];
+    char * data = f->record->data[section] + f->cursor[section];
+
+    f->cursor[section] += size;
+
+    return data;
+}
+
+void CCH_PutInt( Cache * cache, int function, int section, int value )
+{
+    CCH_Put( cache, function, section, &value, sizeof( int ) );
+}
+
+// Strings are kept with their terminator, NULL ones as a length of -1
+void CCH_PutString( Cache * cache, int function, int section, char * str )
+{
+    int length = str ? ( int )strlen( str ) : -1;
+
+    CCH_PutInt( cache, function, section, length );
+
+    if( str )
+        CCH_Put( cache, function, section, str, length + 1 );
+}
+
+int CCH_GetInt( Cache * cache, int function, int section )
+{
+    int value;
+
+    memcpy( &value, CCH_Get( cache, function, section, sizeof( int ) ), sizeof( int ) );
+
+    return value;
+}
+
+// Points into the cache, valid until it is deleted
+char * CCH_GetString( Cache * cache, int function, int section )
+{
+    int length = CCH_GetInt( cache, function, section );
+
+    if( length < 0 )
+        return NULL;
+
+    return CCH_Get( cache, function, section, length + 1 );
+}
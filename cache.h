@@ -0,0 +1,47 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+// On-disk results of a previous compilation, one record per function, for
+// --incremental. A record is found by the key of its function; the phases
+// that use it write and read its sections as sequences of ints and
+// strings, each in the order it was written. Functions are numbered in
+// the order they appear in the program.
+
+#define CCH_TYPING  0
+#define CCH_CODE    1
+#define CCH_SECTIONS 2
+
+// FNV-1a, 64 bits
+#define CCH_HASH_SEED 14695981039346656037ULL
+
+typedef struct cache Cache;
+
+
+Cache * CCH_Load( char * path );
+
+void CCH_Delete( Cache * cache );
+
+void CCH_Save( Cache * cache, char * path );
+
+unsigned long long CCH_Hash( unsigned long long hash, const void * data, size_t size );
+
+void CCH_Reserve( Cache * cache, int nFunctions );
+
+int CCH_Lookup( Cache * cache, int function, unsigned long long key );
+
+int CCH_IsHit( Cache * cache, int function );
+
+int CCH_GetHitCount( Cache * cache );
+
+
+void CCH_PutInt( Cache * cache, int function, int section, int value );
+
+void CCH_PutString( Cache * cache, int function, int section, char * str );
+
+int CCH_GetInt( Cache * cache, int function, int section );
+
+char * CCH_GetString( Cache * cache, int function, int section );
+
+#endif
@@ -2,175 +2,581 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "icr.h"
 #include "list.h"
 #include "symbol.h"
+#include "intern.h"
+#include "arena.h"
+#include "cache.h"
+#include "stats.h"
 
-typedef struct entry Entry;
+#define NTB_INITIAL_SLOTS   16
 
-struct entry
+typedef struct nameTable NameTable;
+
+// Ids of interned names, found by address through open addressing, never
+// more than half full
+struct nameTable
+{
+    char ** names;
+    int * ids;
+    unsigned nSlots;
+    unsigned nUsed;
+};
+
+static void NTB_Init( NameTable * ntb )
+{
+    ntb->nSlots = NTB_INITIAL_SLOTS;
+    ntb->nUsed = 0;
+    ntb->names = ( char** )calloc( ntb->nSlots, sizeof( char* ) );
+    ntb->ids = ( int* )malloc( ntb->nSlots * sizeof( int ) );
+}
+
+static void NTB_Free( NameTable * ntb )
+{
+    free( ntb->names );
+    free( ntb->ids );
+}
+
+static unsigned NTB_Probe( NameTable * ntb, char * name )
+{
+    unsigned i = ( unsigned )( ( size_t )name >> 3 ) & ( ntb->nSlots - 1 );
+
+    while( ntb->names[i] && ntb->names[i] != name )
+        i = ( i + 1 ) & ( ntb->nSlots - 1 );
+
+    return i;
+}
+
+// Id of name, -1 if it has none
+static int NTB_Find( NameTable * ntb, char * name )
+{
+    unsigned i = NTB_Probe( ntb, name );
+
+    return ntb->names[i] ? ntb->ids[i] : -1;
+}
+
+static void NTB_Add( NameTable * ntb, char * name, int id )
+{
+    if( 2 * ( ntb->nUsed + 1 ) > ntb->nSlots )
+    {
+        NameTable grown;
+        unsigned i;
+
+        grown.nSlots = 2 * ntb->nSlots;
+        grown.nUsed = ntb->nUsed;
+        grown.names = ( char** )calloc( grown.nSlots, sizeof( char* ) );
+        grown.ids = ( int* )malloc( grown.nSlots * sizeof( int ) );
+
+        for( i = 0; i < ntb->nSlots; i++ )
+        {
+            if( ntb->names[i] )
+            {
+                unsigned j = NTB_Probe( &grown, ntb->names[i] );
+                grown.names[j] = ntb->names[i];
+                grown.ids[j] = ntb->ids[i];
+            }
+        }
+
+        NTB_Free( ntb );
+        *ntb = grown;
+    }
+
+    unsigned i = NTB_Probe( ntb, name );
+
+    if( !ntb->names[i] )
+    {
+        ntb->names[i] = name;
+        ntb->nUsed++;
+    }
+
+    ntb->ids[i] = id;
+}
+
+/*************************************************************/
+
+static const Operand none = { D_NONE, 0, 0, NULL, NULL };
+
+typedef struct function Function;
+
+struct function
 {
-    int operation;
-    char * value1;
-    char * value2;    
-    char * result;
-    char * label;
+    char * name;
+    char ** locals;     // Params first, each name once
+    int nLocals;
+    int maxLocals;
+    int nParams;
 };
 
-Entry * ETR_New( int op, char * v1, char * v2, char * result )//, char * label )
+struct icr
+{
+    List * entries;
+    Cache * cache;      // Code of unchanged functions, NULL if none
+    Arena * arena;      // Index operands
+    NameTable globals;
+    int nGlobals;
+    NameTable functionIds;
+    Function * functions;
+    int nFunctions;
+
+    // Function being generated, NULL for the globals. A local is in scope
+    // while its count of open declarations is above zero.
+    Function * function;
+    NameTable localIds;
+    int * inScope;
+    int maxLocals;
+    int * declared;     // Locals declared by the open blocks, innermost last
+    int nDeclared;
+    int maxDeclared;
+};
+
+Entry * ETR_New( int op, Operand v1, Operand v2, Operand result )
 {
     Entry * entry = ( Entry* )malloc( sizeof( Entry ) );
-            
+    STS_CountAlloc();
+
     entry->operation = op;
-    entry->value1 = v1 ? strdup( v1 ) : v1;
-    entry->value2 = v2 ? strdup( v2 ) : v2;    
-    entry->result = result ? strdup( result ) : result;          
-    
-    return entry;     
+    entry->value1 = v1;
+    entry->value2 = v2;
+    entry->result = result;
+
+    return entry;
 }
 
 void ETR_Delete( void * entry )
 {
-    Entry * e = ( Entry* )entry;
-    
-    free( e->value1 );
-    free( e->value2 );
-    free( e->result );  
-    
-    free( e );          
+    free( entry );
 }
 
-void ETR_Dump( void * entry )
+// The dump holds the lock of stdout, see ICR_Dump
+static void ETR_Write( const char * str )
 {
-    static int wasLastArg = 0;
-    Entry * e = ( Entry* )entry;
-        
-    if( e->operation == O_LABL )
-        printf( "%s:\n", e->value1 );
-    else if( e->operation == O_FUN )
-        ;
-    else    
-        printf( "\t" );
-    
-    if( e->operation == O_IFF )
+    while( *str )
+        putc_unlocked( *str++, stdout );
+}
+
+// Writes prefix and then number, cheaper than printf for the many temps
+static void OPD_DumpNumbered( const char * prefix, int number )
+{
+    char digits[16];
+    char * curr = digits + sizeof( digits );
+    unsigned value = number < 0 ? -( unsigned )number : ( unsigned )number;
+
+    *--curr = '\0';
+
+    do
     {
-        printf( "ifFalse %s goto %s\n", e->value1, e->result );
+        *--curr = '0' + value % 10;
+        value /= 10;
     }
-    else if( e->operation == O_IFT )
+    while( value );
+
+    if( number < 0 )
+        *--curr = '-';
+
+    ETR_Write( prefix );
+    ETR_Write( curr );
+}
+
+static void OPD_Dump( Operand * o )
+{
+    if( o->isByte )
+        ETR_Write( "byte " );
+
+    switch( o->kind )
     {
-        printf( "if %s goto %s\n", e->value1, e->result );    
+        case D_TEMP:
+            OPD_DumpNumbered( "$t", o->id );
+            break;
+
+        case D_LABEL:
+            OPD_DumpNumbered( ".L", o->id );
+            break;
+
+        case D_RET:
+            ETR_Write( "$ret" );
+            break;
+
+        default:
+            ETR_Write( o->name );
+            break;
     }
-    else if( e->operation == O_ASGN )
+
+    if( o->index )
     {
-        printf( "%s = %s\n", e->result, e->value1 );
+        putc_unlocked( '[', stdout );
+        OPD_Dump( o->index );
+        putc_unlocked( ']', stdout );
     }
-    else if( e->operation == O_CALL )
+}
+
+void ETR_Dump( void * entry, void * icr )
+{
+    Entry * e = ( Entry* )entry;
+    Function * f;
+    int i;
+
+    if( e->operation == O_LABL )
     {
-        printf( "call %s\n", e->value1 );
+        OPD_Dump( &e->value1 );
+        ETR_Write( ":\n" );
+        return;
     }
-    else if( e->operation == O_GOTO )
+
+    // The .ic only heads functions that take parameters
+    if( e->operation == O_FUN )
     {
-        printf( "goto %s\n", e->value1 );
+        f = &( ( Icr* )icr )->functions[e->value1.id];
+
+        if( !f->nParams )
+            return;
+
+        ETR_Write( "fun " );
+        ETR_Write( f->name );
+        putc_unlocked( '(', stdout );
+
+        for( i = 0; i < f->nParams; i++ )
+        {
+            if( i )
+                putc_unlocked( ',', stdout );
+
+            ETR_Write( f->locals[i] );
+        }
+
+        ETR_Write( ")\n" );
+        return;
     }
-    else if( e->operation == O_PARM )
-    {
-        printf( "param %s\n", e->value1 );
-    }    
-    else if( e->operation == O_RET )
+
+    putc_unlocked( '\t', stdout );
+
+    if( e->operation == O_IFF || e->operation == O_IFT )
     {
-        if( e->value1 )
-            printf( "ret %s\n", e->value1 );
-        else
-            printf( "ret\n" );
+        ETR_Write( e->operation == O_IFF ? "ifFalse " : "if " );
+        OPD_Dump( &e->value1 );
+        ETR_Write( " goto " );
+        OPD_Dump( &e->result );
     }
-    else if( e->operation == O_NEW )
+    else if( e->operation == O_ASGN || e->operation == O_NEW )
     {
-        printf( "%s = new %s\n", e->result, e->value1 );
+        OPD_Dump( &e->result );
+        ETR_Write( e->operation == O_NEW ? " = new " : " = " );
+        OPD_Dump( &e->value1 );
     }
-    /*else if( e->operation == O_NOT )
+    else if( e->operation == O_CALL || e->operation == O_GOTO || e->operation == O_PARM )
     {
-        printf( "not %s\n", e->value1 );
-    } */
-    else if( e->operation == O_FUN )
-    {
-        printf( "fun %s(%s)\n", e->value1, e->value2 );
-    } 
-    /*else if( e->operation == O_ARRAY )
+        ETR_Write( e->operation == O_CALL ? "call " : e->operation == O_GOTO ? "goto " : "param " );
+        OPD_Dump( &e->value1 );
+    }
+    else if( e->operation == O_RET )
     {
-        printf( "%s = %s[%s]\n", e->result, e->value1, e->value2 );
-    }*/  
-    else if( e->operation != O_LABL )
+        ETR_Write( "ret" );
+
+        if( e->value1.kind != D_NONE )
+        {
+            putc_unlocked( ' ', stdout );
+            OPD_Dump( &e->value1 );
+        }
+    }
+    else
     {
-        char * str = malloc( 4 );
-        
+        char * str;
+
         switch( e->operation )
 	    {
 	        case O_ADD:
-	            sprintf( str, "+" );
+	            str = "+";
 	            break;
             case O_SUB:
-                sprintf( str, "-" );
-	            break;                
+                str = "-";
+	            break;
             case O_DIV:
-                sprintf( str, "/" );
-	            break;                
+                str = "/";
+	            break;
             case O_MUL:
-                sprintf( str, "*" );
-	            break;                
+                str = "*";
+	            break;
             case O_EQ:
-                sprintf( str, "==" );
-	            break;                
+                str = "==";
+	            break;
             case O_NEQ:
-                sprintf( str, "<>" );
-	            break;                
+                str = "<>";
+	            break;
             case O_LRGR:
-                sprintf( str, ">" );
-	            break;                
+                str = ">";
+	            break;
             case O_SMLR:
-                sprintf( str, "<" );
-	            break;                
+                str = "<";
+	            break;
             case O_LRGRE:
-                sprintf( str, ">=" );
-	            break;                
+                str = ">=";
+	            break;
             case O_SMLRE:
-                sprintf( str, "<=" );
+                str = "<=";
 	            break;
             default:
-                printf( "wut: %d\n", e->operation );                
+                printf( "wut: %d\n", e->operation );
                 assert( 0 );
+                return;
         }
-        printf( "%s = %s %s %s\n", e->result, e->value1, str, e->value2 );
+
+        OPD_Dump( &e->result );
+        ETR_Write( " = " );
+        OPD_Dump( &e->value1 );
+        putc_unlocked( ' ', stdout );
+        ETR_Write( str );
+        putc_unlocked( ' ', stdout );
+        OPD_Dump( &e->value2 );
     }
-}
 
-struct icr
-{
-    List * entries;   
-};
+    putc_unlocked( '\n', stdout );
+}
 
 /*************************************************************/
 
-void ICR_GenerateBlock( Icr * icr, Ast * ast );
-void ICR_GenerateCall( Icr * icr, Ast * ast );
-char * ICR_GenerateVar( Icr * icr, Ast * ast );
+void ICR_GenerateBlock( Icr * icr, AstNode ast );
+void ICR_GenerateCall( Icr * icr, AstNode ast );
+Operand ICR_GenerateVar( Icr * icr, AstNode ast );
 
 static int tempUniqueId = 0;
 static int labelUniqueId = 0;
-static char retId[] = "$ret";
 
-static char * generateTemp()
+static Operand generateTemp()
+{
+    Operand o = none;
+    o.kind = D_TEMP;
+    o.id = tempUniqueId++;
+    return o;
+}
+
+// Gives temp back if no temp was taken after it
+static void releaseTemp( Operand temp )
+{
+    if( tempUniqueId == temp.id + 1 )
+        tempUniqueId--;
+}
+
+static Operand generateLabel()
+{
+    Operand o = none;
+    o.kind = D_LABEL;
+    o.id = labelUniqueId++;
+    return o;
+}
+
+// Takes the interned text of the literal
+static Operand literal( int kind, char * text )
+{
+    Operand o = none;
+    o.kind = kind;
+    o.id = ( kind == D_NUMBER ) ? atoi( text ) : 0;
+    o.name = text;
+    return o;
+}
+
+// Literal 0 or 1
+static Operand constant( int value )
+{
+    static char * texts[2] = { NULL, NULL };
+
+    if( !texts[value] )
+        texts[value] = ITN_InternString( value ? "1" : "0" );
+
+    return literal( D_NUMBER, texts[value] );
+}
+
+// Literal of a value computed here
+static Operand number( int value )
+{
+    char text[16];
+
+    if( value == 0 || value == 1 )
+        return constant( value );
+
+    sprintf( text, "%d", value );
+
+    return literal( D_NUMBER, ITN_InternString( text ) );
+}
+
+static int isNumber( Operand o, int value )
+{
+    return o.kind == D_NUMBER && o.id == value;
+}
+
+static int isSameVariable( Operand a, Operand b )
+{
+    return a.kind == b.kind && ( a.kind == D_TEMP || a.kind == D_LOCAL || a.kind == D_GLOBAL ) &&
+           a.id == b.id && !a.index && !b.index;
+}
+
+// Value of e1 op e2 when it is known at compile time: both are numbers,
+// or an identity such as x*1 or x-x applies. Arithmetic wraps at 32 bits
+// as it does at run time, and division by zero and negative results are
+// left to run time.
+static int ICR_Fold( int op, Operand e1, Operand e2, Operand * result )
+{
+    if( e1.kind == D_NUMBER && e2.kind == D_NUMBER )
+    {
+        unsigned a = ( unsigned )e1.id;
+        unsigned b = ( unsigned )e2.id;
+        int value;
+
+        switch( op )
+        {
+            case O_ADD:
+                value = ( int )( a + b );
+                break;
+            case O_SUB:
+                value = ( int )( a - b );
+                break;
+            case O_MUL:
+                value = ( int )( a * b );
+                break;
+            case O_DIV:
+                if( e2.id == 0 || ( e1.id == INT_MIN && e2.id == -1 ) )
+                    return 0;
+                value = e1.id / e2.id;
+                break;
+            case O_EQ:
+                value = e1.id == e2.id;
+                break;
+            case O_NEQ:
+                value = e1.id != e2.id;
+                break;
+            case O_LRGR:
+                value = e1.id > e2.id;
+                break;
+            case O_SMLR:
+                value = e1.id < e2.id;
+                break;
+            case O_LRGRE:
+                value = e1.id >= e2.id;
+                break;
+            case O_SMLRE:
+                value = e1.id <= e2.id;
+                break;
+            default:
+                return 0;
+        }
+
+        // The backend reads no negative literals, so they stay computed
+        if( value < 0 )
+            return 0;
+
+        *result = number( value );
+        return 1;
+    }
+
+    if( ( ( op == O_ADD || op == O_SUB ) && isNumber( e2, 0 ) ) || ( ( op == O_MUL || op == O_DIV ) && isNumber( e2, 1 ) ) )
+        *result = e1;
+    else if( ( op == O_ADD && isNumber( e1, 0 ) ) || ( op == O_MUL && isNumber( e1, 1 ) ) )
+        *result = e2;
+    else if( op == O_MUL && ( isNumber( e1, 0 ) || isNumber( e2, 0 ) ) )
+        *result = constant( 0 );
+    else if( op == O_SUB && isSameVariable( e1, e2 ) )
+        *result = constant( 0 );
+    else
+        return 0;
+
+    return 1;
+}
+
+static Operand asByte( Operand o )
 {
-    char * str = malloc( 10 );    
-    sprintf( str, "$t%d", tempUniqueId++ );
-    return str;
+    o.isByte = 1;
+    return o;
 }
 
-static char * generateLabel()
+// Element index of base
+static Operand indexed( Icr * icr, Operand base, Operand index )
 {
-    char * str = malloc( 10 );    
-    sprintf( str, ".L%d", labelUniqueId++ );
-    return str;
+    base.index = ( Operand* )ARN_Alloc( icr->arena, sizeof( Operand ) );
+    *base.index = index;
+    return base;
+}
+
+// Innermost variable of that name in scope, or else the function
+static Operand ICR_Resolve( Icr * icr, char * name )
+{
+    Operand o = none;
+    int id = icr->function ? NTB_Find( &icr->localIds, name ) : -1;
+
+    o.name = name;
+
+    if( id >= 0 && icr->inScope[id] )
+    {
+        o.kind = D_LOCAL;
+        o.id = id;
+    }
+    else if( ( id = NTB_Find( &icr->globals, name ) ) >= 0 )
+    {
+        o.kind = D_GLOBAL;
+        o.id = id;
+    }
+    else
+    {
+        o.kind = D_FUNCTION;
+        o.id = NTB_Find( &icr->functionIds, name );
+    }
+
+    return o;
+}
+
+static int ICR_AddLocal( Icr * icr, char * name )
+{
+    Function * f = icr->function;
+    int id = NTB_Find( &icr->localIds, name );
+
+    if( id >= 0 )
+        return id;
+
+    if( f->nLocals == f->maxLocals )
+    {
+        f->maxLocals = f->maxLocals ? 2 * f->maxLocals : 16;
+        f->locals = ( char** )realloc( f->locals, f->maxLocals * sizeof( char* ) );
+    }
+
+    if( f->nLocals == icr->maxLocals )
+    {
+        icr->maxLocals = icr->maxLocals ? 2 * icr->maxLocals : 16;
+        icr->inScope = ( int* )realloc( icr->inScope, icr->maxLocals * sizeof( int ) );
+    }
+
+    f->locals[f->nLocals] = name;
+    icr->inScope[f->nLocals] = 0;
+    NTB_Add( &icr->localIds, name, f->nLocals );
+
+    return f->nLocals++;
+}
+
+static Operand ICR_Declare( Icr * icr, char * name )
+{
+    if( !icr->function )
+    {
+        NTB_Add( &icr->globals, name, icr->nGlobals++ );
+        return ICR_Resolve( icr, name );
+    }
+
+    int id = ICR_AddLocal( icr, name );
+
+    if( icr->nDeclared == icr->maxDeclared )
+    {
+        icr->maxDeclared = icr->maxDeclared ? 2 * icr->maxDeclared : 16;
+        icr->declared = ( int* )realloc( icr->declared, icr->maxDeclared * sizeof( int ) );
+    }
+
+    icr->declared[icr->nDeclared++] = id;
+    icr->inScope[id]++;
+
+    return ICR_Resolve( icr, name );
+}
+
+// Ends the scope of the locals declared since the block opened at mark
+static void ICR_CloseBlock( Icr * icr, int mark )
+{
+    while( icr->nDeclared > mark )
+        icr->inScope[icr->declared[--icr->nDeclared]]--;
 }
 
 int ICR_AstTypeToIcr( int type )
@@ -203,11 +609,11 @@ int ICR_AstTypeToIcr( int type )
     }
 }
 
-char * ICR_GenerateExpression( Icr * icr, Ast * ast )
+Operand ICR_GenerateExpression( Icr * icr, AstNode ast )
 {
-    Ast * child;
+    AstNode child;
     int type = AST_GetNodeType( ast );
-    
+
     switch( type )
 	{
 	    case A_ADD:
@@ -221,351 +627,313 @@ char * ICR_GenerateExpression( Icr * icr, Ast * ast )
         case A_LARGEREQ:
         case A_SMALLEREQ:
         {
-            char * temp = generateTemp();
-            
+            Operand temp = generateTemp();
+
             child = AST_GetChild( ast );
-            char * e1 = ICR_GenerateExpression( icr, child );
-            
+            Operand e1 = ICR_GenerateExpression( icr, child );
+
             child = AST_NextSibling( child );
-            char * e2 = ICR_GenerateExpression( icr, child );
-            free( child );
-            
+            Operand e2 = ICR_GenerateExpression( icr, child );
+
             int op = ICR_AstTypeToIcr( type );
+            Operand folded;
+
+            if( ICR_Fold( op, e1, e2, &folded ) )
+            {
+                releaseTemp( temp );
+                return folded;
+            }
+
             LIS_PushBack( icr->entries, ETR_New( op, e1, e2, temp ) );
-            
-            return temp;            
+
+            return temp;
         }
             break;
-            
+
         case A_AND:
-        {
-            char * temp = generateTemp();
-            char * label = generateLabel();
-            char * endLabel = generateLabel();
-            
-            child = AST_GetChild( ast );
-            char * e1 = ICR_GenerateExpression( icr, child );
-            
-            child = AST_NextSibling( child );
-            char * e2 = ICR_GenerateExpression( icr, child );
-            free( child );            
-            
-            LIS_PushBack( icr->entries, ETR_New( O_IFF, e1, NULL, label ) );
-            
-            char * e1b = malloc( 64 );
-            strcpy( e1b, "" );
-            sprintf( e1b, "byte %s", e1 );
-            char * e2b = malloc( 64 );
-            strcpy( e2b, "" );            
-            sprintf( e2b, "byte %s", e2 );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_ASGN, e2b, NULL, temp ) );
-            LIS_PushBack( icr->entries, ETR_New( O_GOTO, endLabel, NULL, NULL ) );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_LABL, label, NULL, NULL ) );
-            LIS_PushBack( icr->entries, ETR_New( O_ASGN, e1b, NULL, temp ) );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_LABL, endLabel, NULL, NULL ) );
-            
-            return temp;  
-        }
-            break;
-            
         case A_OR:
         {
-            char * temp = generateTemp();
-            char * label = generateLabel();
-            char * endLabel = generateLabel();
-            
+            Operand temp = generateTemp();
+            Operand label = generateLabel();
+            Operand endLabel = generateLabel();
+
             child = AST_GetChild( ast );
-            char * e1 = ICR_GenerateExpression( icr, child );
-            
+            Operand e1 = ICR_GenerateExpression( icr, child );
+
             child = AST_NextSibling( child );
-            char * e2 = ICR_GenerateExpression( icr, child );
-            free( child );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_IFT, e1, NULL, label ) );
-            
-            char * e1b = malloc( 64 );
-            strcpy( e1b, "" );
-            sprintf( e1b, "byte %s", e1 );
-            char * e2b = malloc( 64 );
-            strcpy( e2b, "" );            
-            sprintf( e2b, "byte %s", e2 );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_ASGN, e2b, NULL, temp ) );
-            LIS_PushBack( icr->entries, ETR_New( O_GOTO, endLabel, NULL, NULL ) );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_LABL, label, NULL, NULL ) );
-            LIS_PushBack( icr->entries, ETR_New( O_ASGN, e1b, NULL, temp ) );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_LABL, endLabel, NULL, NULL ) );
-            
-            return temp;  
+            Operand e2 = ICR_GenerateExpression( icr, child );
+
+            LIS_PushBack( icr->entries, ETR_New( type == A_AND ? O_IFF : O_IFT, e1, none, label ) );
+
+            LIS_PushBack( icr->entries, ETR_New( O_ASGN, asByte( e2 ), none, temp ) );
+            LIS_PushBack( icr->entries, ETR_New( O_GOTO, endLabel, none, none ) );
+
+            LIS_PushBack( icr->entries, ETR_New( O_LABL, label, none, none ) );
+            LIS_PushBack( icr->entries, ETR_New( O_ASGN, asByte( e1 ), none, temp ) );
+
+            LIS_PushBack( icr->entries, ETR_New( O_LABL, endLabel, none, none ) );
+
+            return temp;
         }
             break;
-        
+
         case A_NOT:
         {
-            char * temp = generateTemp();
-            char * label = generateLabel();
-            char * endLabel = generateLabel();
-                        
+            Operand temp = generateTemp();
+            Operand label = generateLabel();
+            Operand endLabel = generateLabel();
+
             child = AST_GetChild( ast );
-            char * e = ICR_GenerateExpression( icr, child );
-            free( child );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_IFF, e, NULL, label ) );
-            LIS_PushBack( icr->entries, ETR_New( O_ASGN, "0", NULL, temp ) );
-            LIS_PushBack( icr->entries, ETR_New( O_GOTO, endLabel, NULL, NULL ) ); 
-            LIS_PushBack( icr->entries, ETR_New( O_LABL, label, NULL, NULL ) );
-            LIS_PushBack( icr->entries, ETR_New( O_ASGN, "1", NULL, temp ) );
-            LIS_PushBack( icr->entries, ETR_New( O_LABL, endLabel, NULL, NULL ) );
-                                   
-            return temp;            
+            Operand e = ICR_GenerateExpression( icr, child );
+
+            LIS_PushBack( icr->entries, ETR_New( O_IFF, e, none, label ) );
+            LIS_PushBack( icr->entries, ETR_New( O_ASGN, constant( 0 ), none, temp ) );
+            LIS_PushBack( icr->entries, ETR_New( O_GOTO, endLabel, none, none ) );
+            LIS_PushBack( icr->entries, ETR_New( O_LABL, label, none, none ) );
+            LIS_PushBack( icr->entries, ETR_New( O_ASGN, constant( 1 ), none, temp ) );
+            LIS_PushBack( icr->entries, ETR_New( O_LABL, endLabel, none, none ) );
+
+            return temp;
         }
             break;
-            
+
         case A_NEGATIVE:
         {
-            char * temp = generateTemp();
-            
+            Operand temp = generateTemp();
+
             child = AST_GetChild( ast );
-            char * e = ICR_GenerateExpression( icr, child );            
-            free( child );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_SUB, "0", e, temp ) );
-            
+            Operand e = ICR_GenerateExpression( icr, child );
+            Operand folded;
+
+            if( ICR_Fold( O_SUB, constant( 0 ), e, &folded ) )
+            {
+                releaseTemp( temp );
+                return folded;
+            }
+
+            LIS_PushBack( icr->entries, ETR_New( O_SUB, constant( 0 ), e, temp ) );
+
             return temp;
         }
             break;
-            
+
         case A_NEW:
         {
-            Ast * child = AST_GetChild( ast );            
-            char * temp = generateTemp();
-            char * e = ICR_GenerateExpression( icr, child );
-            free( child );
-            
-            LIS_PushBack( icr->entries, ETR_New( O_NEW, e, NULL, temp ) );
-            
+            AstNode child = AST_GetChild( ast );
+            Operand temp = generateTemp();
+            Operand e = ICR_GenerateExpression( icr, child );
+
+            LIS_PushBack( icr->entries, ETR_New( O_NEW, e, none, temp ) );
+
             return temp;
         }
             break;
-        
+
 	    case A_VAR:
-	    {        
+	    {
 	        return ICR_GenerateVar( icr, ast );
 	    }
 	        break;
-	        
+
 	    case A_CALL:
 	    {
-	        char * id = AST_FindId( ast );
+	        Operand ret = none;
+	        ret.kind = D_RET;
+
 	        ICR_GenerateCall( icr, ast );
-	        char * temp = generateTemp();
-	        LIS_PushBack( icr->entries, ETR_New( O_ASGN, retId, NULL, temp ) );
-	        
+	        Operand temp = generateTemp();
+	        LIS_PushBack( icr->entries, ETR_New( O_ASGN, ret, none, temp ) );
+
 	        return temp;
 	    }
 	        break;
-	            
+
         case A_LITINT:
-        case A_LITSTRING:        
         {
-            char * e = malloc( 20 );
-            e = strdup( AST_GetNodeValue( ast ) );
-            
-            return e;
+            return literal( D_NUMBER, AST_GetNodeValue( ast ) );
         }
             break;
-          
+
+        case A_LITSTRING:
+        {
+            return literal( D_STRING, AST_GetNodeValue( ast ) );
+        }
+            break;
+
         case A_TRUE:
         {
-            return "1";
+            return constant( 1 );
         }
             break;
-            
+
         case A_FALSE:
         {
-            return "0";
+            return constant( 0 );
         }
             break;
-               
+
         default:
         {
             printf( "ERROR: %d\n", type );
             assert( 0 );
         }
 	}
-	
-	return NULL;
+
+	return none;
 }
 
-void ICR_GenerateParams( Icr * icr, Ast * ast )
+void ICR_GenerateParams( Icr * icr, AstNode ast )
 {
-    Ast * child;
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    AstNode child;
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
-	    char * exp = ICR_GenerateExpression( icr, child );
-	    LIS_PushBack( icr->entries, ETR_New( O_PARM, exp, NULL, NULL ) );
+	    Operand exp = ICR_GenerateExpression( icr, child );
+	    LIS_PushBack( icr->entries, ETR_New( O_PARM, exp, none, none ) );
 	}
 }
 
-void ICR_GenerateCall( Icr * icr, Ast * ast )
-{    
+void ICR_GenerateCall( Icr * icr, AstNode ast )
+{
     char * id = AST_FindId( ast );
-    Ast * child = AST_GetChild( ast );
+    AstNode child = AST_GetChild( ast );
     child = AST_NextSibling( child );
     ICR_GenerateParams( icr, child );
-    free( child );
-    LIS_PushBack( icr->entries, ETR_New( O_CALL, id, NULL, NULL ) );
+    LIS_PushBack( icr->entries, ETR_New( O_CALL, ICR_Resolve( icr, id ), none, none ) );
 }
 
-void ICR_GenerateReturn( Icr * icr, Ast * ast )
-{    
-    Ast * child = AST_GetChild( ast );
-    
-    if( child )
+void ICR_GenerateReturn( Icr * icr, AstNode ast )
+{
+    AstNode child = AST_GetChild( ast );
+
+    if( !AST_IsNull( child ) )
     {
-        char * exp = ICR_GenerateExpression( icr, child );
-        LIS_PushBack( icr->entries, ETR_New( O_RET, exp, NULL, NULL ) );
+        Operand exp = ICR_GenerateExpression( icr, child );
+        LIS_PushBack( icr->entries, ETR_New( O_RET, exp, none, none ) );
     }
     else
     {
-        LIS_PushBack( icr->entries, ETR_New( O_RET, NULL, NULL, NULL ) );
+        LIS_PushBack( icr->entries, ETR_New( O_RET, none, none, none ) );
     }
-    
-    free( child );
 }
 
-char * ICR_GenerateVar( Icr * icr, Ast * ast )
+Operand ICR_GenerateVar( Icr * icr, AstNode ast )
 {
-    char * id;
-	        
-    Ast * child;
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    Operand id = none;
+
+    AstNode child;
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
     {
         int type = AST_GetNodeType( child );
         if( type == A_ID )
         {
-            id = AST_GetNodeValue( child );
+            id = ICR_Resolve( icr, AST_GetNodeValue( child ) );
         }
         else
         {
             if( !AST_HasNext( child ) )
             {
-                char * exp = ICR_GenerateExpression( icr, child );
-                char * var = malloc( 64 );
-                sprintf( var, "%s[%s]", id, exp );
-                id = var;
-                free( child );
+                Operand exp = ICR_GenerateExpression( icr, child );
+                id = indexed( icr, id, exp );
                 break;
-            }            
-            
-            char * exp = ICR_GenerateExpression( icr, child );
-            char * temp = generateTemp();
-            char * var = malloc( 64 );
-            sprintf( var, "%s[%s]", id, exp );
-            LIS_PushBack( icr->entries, ETR_New( O_ASGN, var, NULL, temp ) );
+            }
+
+            Operand exp = ICR_GenerateExpression( icr, child );
+            Operand temp = generateTemp();
+            LIS_PushBack( icr->entries, ETR_New( O_ASGN, indexed( icr, id, exp ), none, temp ) );
             id = temp;
         }
     }
-    
+
     return id;
 }
 
-void ICR_GenerateAssign( Icr * icr, Ast * ast )
+void ICR_GenerateAssign( Icr * icr, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
-    char * var = ICR_GenerateVar( icr, child );
-    
+    AstNode child = AST_GetChild( ast );
+    Operand var = ICR_GenerateVar( icr, child );
+
     child = AST_NextSibling( child );
-    char * exp = malloc( 64 );    
-    strcpy( exp, "" );
-    
+    Operand exp = ICR_GenerateExpression( icr, child );
+
     if( SYM_GetPtrType( AST_GetNodeAnnotation( child ) ) == 0 )
-        strcat( exp, "byte " );
-        
-    strcat( exp, ICR_GenerateExpression( icr, child ) );
-    
-    LIS_PushBack( icr->entries, ETR_New( O_ASGN, exp, NULL, var ) );
-    free( child );    
-}
-
-void ICR_GenerateWhile( Icr * icr, Ast * ast )
-{
-    Ast * child = AST_GetChild( ast );
-    char * exp = ICR_GenerateExpression( icr, child );
-    char * startLabel = generateLabel();
-    char * endLabel = generateLabel();
-    
-    LIS_PushBack( icr->entries, ETR_New( O_LABL, startLabel, NULL, NULL ) );    
-    LIS_PushBack( icr->entries, ETR_New( O_IFF, exp, NULL, endLabel ) );
-    
+        exp = asByte( exp );
+
+    LIS_PushBack( icr->entries, ETR_New( O_ASGN, exp, none, var ) );
+}
+
+void ICR_GenerateWhile( Icr * icr, AstNode ast )
+{
+    AstNode child = AST_GetChild( ast );
+    Operand exp = ICR_GenerateExpression( icr, child );
+    Operand startLabel = generateLabel();
+    Operand endLabel = generateLabel();
+
+    LIS_PushBack( icr->entries, ETR_New( O_LABL, startLabel, none, none ) );
+    LIS_PushBack( icr->entries, ETR_New( O_IFF, exp, none, endLabel ) );
+
     child = AST_NextSibling( child );
     ICR_GenerateBlock( icr, child );
-    LIS_PushBack( icr->entries, ETR_New( O_GOTO, startLabel, NULL, NULL ) );
-    LIS_PushBack( icr->entries, ETR_New( O_LABL, endLabel, NULL, NULL ) );
-    
-    free( child );
+    LIS_PushBack( icr->entries, ETR_New( O_GOTO, startLabel, none, none ) );
+    LIS_PushBack( icr->entries, ETR_New( O_LABL, endLabel, none, none ) );
 }
 
-void ICR_GenerateIf( Icr * icr, Ast * ast )
+void ICR_GenerateIf( Icr * icr, AstNode ast )
 {
-    char * endLabel = generateLabel();
-    char * label = generateLabel();
+    Operand endLabel = generateLabel();
+    Operand label = generateLabel();
     int firstRun = 1;
     int hasElse = 0;
-    Ast * child;    
-    
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    AstNode child;
+
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
 	    int type = AST_GetNodeType( child );
 	    if( type != A_BLOCK ) //If expression
 	    {
 	        if( !firstRun )
 	        {
-	            LIS_PushBack( icr->entries, ETR_New( O_GOTO, endLabel, NULL, NULL ) );
-	            LIS_PushBack( icr->entries, ETR_New( O_LABL, label, NULL, NULL ) );
+	            LIS_PushBack( icr->entries, ETR_New( O_GOTO, endLabel, none, none ) );
+	            LIS_PushBack( icr->entries, ETR_New( O_LABL, label, none, none ) );
 	            label = generateLabel();
 	        }
-	        
-	        char * exp = ICR_GenerateExpression( icr, child );    
-	        LIS_PushBack( icr->entries, ETR_New( O_IFF, exp, NULL, label ) );
-	        
+
+	        Operand exp = ICR_GenerateExpression( icr, child );
+	        LIS_PushBack( icr->entries, ETR_New( O_IFF, exp, none, label ) );
+
 	        child = AST_NextSibling( child );
-	        ICR_GenerateBlock( icr, child );        
+	        ICR_GenerateBlock( icr, child );
 	    }
 	    else
 	    {
-	        LIS_PushBack( icr->entries, ETR_New( O_GOTO, endLabel, NULL, NULL ) );
-	        LIS_PushBack( icr->entries, ETR_New( O_LABL, label, NULL, NULL ) );
+	        LIS_PushBack( icr->entries, ETR_New( O_GOTO, endLabel, none, none ) );
+	        LIS_PushBack( icr->entries, ETR_New( O_LABL, label, none, none ) );
 	        ICR_GenerateBlock( icr, child );
-	        
+
 	        hasElse = 1;
-	    }	    
-	    
+	    }
+
 	    firstRun = 0;
 	}
-	
+
 	// Creates a second label. How to fix?
 	if( !hasElse )
-	    LIS_PushBack( icr->entries, ETR_New( O_LABL, label, NULL, NULL ) );
-           
-    LIS_PushBack( icr->entries, ETR_New( O_LABL, endLabel, NULL, NULL ) );
+	    LIS_PushBack( icr->entries, ETR_New( O_LABL, label, none, none ) );
+
+    LIS_PushBack( icr->entries, ETR_New( O_LABL, endLabel, none, none ) );
 }
 
-void ICR_GenerateDeclaration( Icr * icr, Ast * ast )
+void ICR_GenerateDeclaration( Icr * icr, AstNode ast )
 {
-    char * id = AST_FindId( ast );
-    LIS_PushBack( icr->entries, ETR_New( O_ASGN, "byte 0", NULL, id ) );
+    Operand id = ICR_Declare( icr, AST_FindId( ast ) );
+    LIS_PushBack( icr->entries, ETR_New( O_ASGN, asByte( constant( 0 ) ), none, id ) );
 }
 
-void ICR_GenerateBlock( Icr * icr, Ast * ast )
+void ICR_GenerateBlock( Icr * icr, AstNode ast )
 {
-    Ast * child;    
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    int mark = icr->nDeclared;
+    AstNode child;
+
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
 	    int type = AST_GetNodeType( child );
 	    switch( type )
@@ -573,126 +941,389 @@ void ICR_GenerateBlock( Icr * icr, Ast * ast )
 	        case A_DECLVAR:
 	            ICR_GenerateDeclaration( icr, child );
 	            break;
-	            
+
 	        case A_IF:
 	            ICR_GenerateIf( icr, child );
 	            break;
-	            
+
 	        case A_WHILE:
 	            ICR_GenerateWhile( icr, child );
 	            break;
-	            
+
 	        case A_ASSIGN:
 	            ICR_GenerateAssign( icr, child );
 	            break;
-	            
+
 	        case A_CALL:
 	            ICR_GenerateCall( icr, child );
 	            break;
-	            
+
 	        case A_RETURN:
 	            ICR_GenerateReturn( icr, child );
 	            break;
-	            
+
 	        default:
 	            printf( "block: %d\n", type );
 	            assert( 0 );
 	            break;
 	    }
 	}
+
+	ICR_CloseBlock( icr, mark );
 }
 
-char * ICR_GenerateArgs( Icr * icr, Ast * ast )
+// Parameters are the first locals, in scope for the whole function
+void ICR_GenerateArgs( Icr * icr, AstNode ast )
 {
-    char * str = malloc( 64 );
-    strcpy( str, "" );
-    int firstLoop = 1;
-    Ast * child;    
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
-	{
-	    char * id = AST_FindId( child );
-	    if( !firstLoop )
-    	    strcat( str, "," );
-    	    
-    	strcat( str, id );
-    	
-    	firstLoop = 0;
-	}
-	
-	return str;
+    AstNode child;
+
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
+        ICR_Declare( icr, AST_FindId( child ) );
+
+    icr->function->nParams = icr->function->nLocals;
 }
 
-void ICR_GenerateFunction( Icr * icr, Ast * ast )
+static void ICR_OpenFunction( Icr * icr, int function )
 {
-    char * id = AST_FindId( ast );
-    char * args;    
-    
-    Ast * child;    
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    icr->function = &icr->functions[function];
+    NTB_Init( &icr->localIds );
+}
+
+static void ICR_CloseFunction( Icr * icr )
+{
+    ICR_CloseBlock( icr, 0 );
+    NTB_Free( &icr->localIds );
+    icr->function = NULL;
+}
+
+void ICR_GenerateFunction( Icr * icr, AstNode ast, int function )
+{
+    Operand id = none;
+
+    id.kind = D_FUNCTION;
+    id.id = function;
+    id.name = icr->functions[function].name;
+
+    ICR_OpenFunction( icr, function );
+    LIS_PushBack( icr->entries, ETR_New( O_FUN, id, none, none ) );
+
+    AstNode child;
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
 	    int type = AST_GetNodeType( child );
-	    
+
 	    if( type == A_PARAMS )
-	    {
-	        args = ICR_GenerateArgs( icr, child );
-	        LIS_PushBack( icr->entries, ETR_New( O_FUN, id, args, NULL ) );
-	    }
-	        	        
+	        ICR_GenerateArgs( icr, child );
+
 	    else if( type == A_BLOCK )
-            ICR_GenerateBlock( icr, child ); 
-    }    
-   
-    LIS_PushBack( icr->entries, ETR_New( O_RET, NULL, NULL, NULL ) );
+            ICR_GenerateBlock( icr, child );
+    }
+
+    LIS_PushBack( icr->entries, ETR_New( O_RET, none, none, none ) );
+
+    ICR_CloseFunction( icr );
 }
 
-void ICR_GenerateGlobals( Icr * icr, Ast * ast )
+void ICR_GenerateGlobals( Icr * icr, AstNode ast )
 {
-    Ast * child;    
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    AstNode child;
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
 	    if( AST_GetNodeType( child ) == A_DECLVAR )
         {
             ICR_GenerateDeclaration( icr, child );
         }
-	}    
+	}
+}
+
+/*************************************************************/
+
+typedef struct codeWriter CodeWriter;
+
+// Names repeat within a function, so the cache keeps each once and
+// operands refer to it by index
+struct codeWriter
+{
+    Cache * cache;
+    int function;
+    int tempBase;
+    int labelBase;
+    NameTable nameIds;
+    char ** names;
+    int nNames;
+    int maxNames;
+};
+
+static void ICR_AddName( CodeWriter * w, char * name )
+{
+    if( !name || NTB_Find( &w->nameIds, name ) >= 0 )
+        return;
+
+    if( w->nNames == w->maxNames )
+    {
+        w->maxNames = w->maxNames ? 2 * w->maxNames : 16;
+        w->names = ( char** )realloc( w->names, w->maxNames * sizeof( char* ) );
+    }
+
+    NTB_Add( &w->nameIds, name, w->nNames );
+    w->names[w->nNames++] = name;
+}
+
+static void OPD_AddNames( CodeWriter * w, Operand * o )
+{
+    ICR_AddName( w, o->name );
+
+    if( o->index )
+        OPD_AddNames( w, o->index );
+}
+
+static void ETR_AddNames( void * entry, void * writer )
+{
+    Entry * e = ( Entry* )entry;
+
+    OPD_AddNames( ( CodeWriter* )writer, &e->value1 );
+    OPD_AddNames( ( CodeWriter* )writer, &e->value2 );
+    OPD_AddNames( ( CodeWriter* )writer, &e->result );
+}
+
+// Temps and labels are counted from the first ones of the function, globals
+// and functions are found again by name when read
+static void OPD_Store( CodeWriter * w, Operand * o )
+{
+    int id = o->id;
+
+    if( o->kind == D_TEMP )
+        id -= w->tempBase;
+    else if( o->kind == D_LABEL )
+        id -= w->labelBase;
+
+    CCH_PutInt( w->cache, w->function, CCH_CODE, o->kind | ( o->isByte << 8 ) | ( ( o->index != NULL ) << 9 ) );
+    CCH_PutInt( w->cache, w->function, CCH_CODE, id );
+    CCH_PutInt( w->cache, w->function, CCH_CODE, o->name ? NTB_Find( &w->nameIds, o->name ) : -1 );
+
+    if( o->index )
+        OPD_Store( w, o->index );
+}
+
+static void ETR_Store( void * entry, void * writer )
+{
+    Entry * e = ( Entry* )entry;
+    CodeWriter * w = ( CodeWriter* )writer;
+
+    CCH_PutInt( w->cache, w->function, CCH_CODE, e->operation );
+    OPD_Store( w, &e->value1 );
+    OPD_Store( w, &e->value2 );
+    OPD_Store( w, &e->result );
+}
+
+// Generates a function apart from the entries before it, so that they can
+// be kept in the cache
+static void ICR_CacheFunction( Icr * icr, AstNode ast, int function )
+{
+    List * entries = icr->entries;
+    Function * f = &icr->functions[function];
+    CodeWriter w;
+    int i;
+
+    w.cache = icr->cache;
+    w.function = function;
+    w.tempBase = tempUniqueId;
+    w.labelBase = labelUniqueId;
+    w.names = NULL;
+    w.nNames = 0;
+    w.maxNames = 0;
+    NTB_Init( &w.nameIds );
+
+    icr->entries = LIS_New();
+    ICR_GenerateFunction( icr, ast, function );
+
+    for( i = 0; i < f->nLocals; i++ )
+        ICR_AddName( &w, f->locals[i] );
+
+    LIS_ForEach( icr->entries, &ETR_AddNames, &w );
+
+    CCH_PutInt( icr->cache, function, CCH_CODE, tempUniqueId - w.tempBase );
+    CCH_PutInt( icr->cache, function, CCH_CODE, labelUniqueId - w.labelBase );
+    CCH_PutInt( icr->cache, function, CCH_CODE, w.nNames );
+
+    for( i = 0; i < w.nNames; i++ )
+        CCH_PutString( icr->cache, function, CCH_CODE, w.names[i] );
+
+    CCH_PutInt( icr->cache, function, CCH_CODE, f->nLocals );
+    CCH_PutInt( icr->cache, function, CCH_CODE, f->nParams );
+    CCH_PutInt( icr->cache, function, CCH_CODE, LIS_GetSize( icr->entries ) );
+    LIS_ForEach( icr->entries, &ETR_Store, &w );
+
+    NTB_Free( &w.nameIds );
+    free( w.names );
+
+    LIS_Append( entries, icr->entries );
+    icr->entries = entries;
+}
+
+static Operand OPD_Restore( Icr * icr, int function, char ** names )
+{
+    Operand o = none;
+    int flags = CCH_GetInt( icr->cache, function, CCH_CODE );
+
+    o.kind = flags & 0xFF;
+    o.isByte = ( flags >> 8 ) & 1;
+    o.id = CCH_GetInt( icr->cache, function, CCH_CODE );
+    o.name = names[CCH_GetInt( icr->cache, function, CCH_CODE )];
+
+    if( o.kind == D_TEMP )
+        o.id += tempUniqueId;
+    else if( o.kind == D_LABEL )
+        o.id += labelUniqueId;
+    else if( o.kind == D_GLOBAL )
+        o.id = NTB_Find( &icr->globals, o.name );
+    else if( o.kind == D_FUNCTION )
+        o.id = NTB_Find( &icr->functionIds, o.name );
+
+    if( flags & ( 1 << 9 ) )
+        o = indexed( icr, o, OPD_Restore( icr, function, names ) );
+
+    return o;
+}
+
+// Entries of a function from the cache, with its temps and labels taken
+// next as if it had been generated here
+static void ICR_RestoreFunction( Icr * icr, int function )
+{
+    Function * f = &icr->functions[function];
+    int nTemps = CCH_GetInt( icr->cache, function, CCH_CODE );
+    int nLabels = CCH_GetInt( icr->cache, function, CCH_CODE );
+    int nNames = CCH_GetInt( icr->cache, function, CCH_CODE );
+    char ** names = ( char** )malloc( ( nNames + 1 ) * sizeof( char* ) );
+    int i;
+
+    // Index -1 is no name
+    *names++ = NULL;
+
+    for( i = 0; i < nNames; i++ )
+        names[i] = ITN_InternString( CCH_GetString( icr->cache, function, CCH_CODE ) );
+
+    // Locals are the first names
+    f->nLocals = CCH_GetInt( icr->cache, function, CCH_CODE );
+    f->nParams = CCH_GetInt( icr->cache, function, CCH_CODE );
+    f->maxLocals = f->nLocals + 1;
+    f->locals = ( char** )malloc( f->maxLocals * sizeof( char* ) );
+    memcpy( f->locals, names, f->nLocals * sizeof( char* ) );
+
+    int nEntries = CCH_GetInt( icr->cache, function, CCH_CODE );
+
+    for( i = 0; i < nEntries; i++ )
+    {
+        int op = CCH_GetInt( icr->cache, function, CCH_CODE );
+        Operand v1 = OPD_Restore( icr, function, names );
+        Operand v2 = OPD_Restore( icr, function, names );
+        Operand result = OPD_Restore( icr, function, names );
+
+        LIS_PushBack( icr->entries, ETR_New( op, v1, v2, result ) );
+    }
+
+    free( names - 1 );
+
+    tempUniqueId += nTemps;
+    labelUniqueId += nLabels;
 }
 
 /*************************************************************/
 
 Icr * ICR_New()
 {
-    Icr * icr = ( Icr* )malloc( sizeof( Icr ) );
-    
+    Icr * icr = ( Icr* )calloc( 1, sizeof( Icr ) );
+
     icr->entries = LIS_New();
-    
+    icr->arena = ARN_New();
+    NTB_Init( &icr->globals );
+    NTB_Init( &icr->functionIds );
+
     return icr;
 }
 
 void ICR_Delete( Icr * icr )
 {
+    int i;
+
+    for( i = 0; i < icr->nFunctions; i++ )
+        free( icr->functions[i].locals );
+
     LIS_Delete( icr->entries, &ETR_Delete );
+    ARN_Delete( icr->arena );
+    NTB_Free( &icr->globals );
+    NTB_Free( &icr->functionIds );
+    free( icr->functions );
+    free( icr->inScope );
+    free( icr->declared );
     free( icr );
 }
 
+void ICR_SetCache( Icr * icr, Cache * cache )
+{
+    icr->cache = cache;
+}
+
+// Functions the cache holds code for are not generated again. They are
+// numbered as in SYT_Build, which looked them up.
 void ICR_Build( Icr * icr, Ast * ast )
 {
-    ICR_GenerateGlobals( icr, ast );
-    
-    Ast * child;    
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    AstNode root = AST_GetRoot( ast );
+    int function = 0;
+    AstNode child;
+
+    for( child = AST_GetChild( root ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
+	{
+	    if( AST_GetNodeType( child ) == A_FUNCTION )
+            icr->nFunctions++;
+    }
+
+    icr->functions = ( Function* )calloc( icr->nFunctions, sizeof( Function ) );
+
+    for( child = AST_GetChild( root ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
 	    if( AST_GetNodeType( child ) == A_FUNCTION )
         {
-            ICR_GenerateFunction( icr, child );
+            icr->functions[function].name = AST_FindId( child );
+            NTB_Add( &icr->functionIds, icr->functions[function].name, function );
+            function++;
         }
-	}   
-	
-	printf( "Generated intermediate code!\n" ); 
+    }
+
+    ICR_GenerateGlobals( icr, root );
+
+    function = 0;
+
+    for( child = AST_GetChild( root ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
+	{
+	    if( AST_GetNodeType( child ) == A_FUNCTION )
+        {
+            if( !icr->cache )
+                ICR_GenerateFunction( icr, child, function );
+            else if( CCH_IsHit( icr->cache, function ) )
+                ICR_RestoreFunction( icr, function );
+            else
+                ICR_CacheFunction( icr, child, function );
+
+            function++;
+        }
+	}
+
+	printf( "Generated intermediate code!\n" );
 }
 
+// Entries are written a few characters at a time, so stdout is locked
+// once for all of them
 void ICR_Dump( Icr * icr )
 {
-    LIS_Dump( icr->entries, &ETR_Dump );
+    flockfile( stdout );
+    LIS_ForEach( icr->entries, &ETR_Dump, icr );
+    funlockfile( stdout );
+}
+
+int ICR_GetSize( Icr * icr )
+{
+    return LIS_GetSize( icr->entries );
 }
 
 void ICR_WriteToFile( Icr * icr, char * path )
@@ -702,7 +1333,33 @@ void ICR_WriteToFile( Icr * icr, char * path )
     {
         exit( EXIT_FAILURE );
     }
-    
+
     ICR_Dump( icr );
     fclose( stdout );
 }
+
+void ICR_ForEach( Icr * icr, void (*pfunc)( void *, void * ), void * context )
+{
+    LIS_ForEach( icr->entries, pfunc, context );
+}
+
+char * ICR_GetFunctionName( Icr * icr, int function )
+{
+    return icr->functions[function].name;
+}
+
+int ICR_GetParamCount( Icr * icr, int function )
+{
+    return icr->functions[function].nParams;
+}
+
+int ICR_GetLocalCount( Icr * icr, int function )
+{
+    return icr->functions[function].nLocals;
+}
+
+// Parameters are the first locals
+char * ICR_GetLocal( Icr * icr, int function, int local )
+{
+    return icr->functions[function].locals[local];
+}
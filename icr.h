@@ -2,6 +2,7 @@
 #define ICR_H
 
 #include "ast.h"
+#include "cache.h"
 
 // Operations
 #define O_IFT   1
@@ -31,6 +32,42 @@
 #define O_FUN   20
 //#define O_ARRAY 25
 
+// Kinds of operand
+#define D_NONE      0
+#define D_TEMP      1   // id numbers the temps of the program
+#define D_LOCAL     2   // id indexes the locals of the function, params first
+#define D_GLOBAL    3   // id indexes the globals
+#define D_NUMBER    4   // id is the value
+#define D_STRING    5   // Literal, name is its text
+#define D_LABEL     6   // id numbers the labels of the program
+#define D_FUNCTION  7   // id indexes the functions
+#define D_RET       8   // Value returned by the last call
+
+typedef struct operand Operand;
+
+// Address of a three-address entry, as in the backend's Addr. Variables,
+// functions and literals keep the interned text the .ic prints for them.
+struct operand
+{
+    char kind;
+    char isByte;        // Only the low byte is read: "byte x"
+    int id;
+    char * name;        // NULL for temps, labels and $ret
+    Operand * index;    // Element index[] of the operand: "x[index]"
+};
+
+typedef struct entry Entry;
+
+// Three-address entry: result = value1 operation value2. Every function
+// starts with an O_FUN entry whose value1 is the function.
+struct entry
+{
+    int operation;
+    Operand value1;
+    Operand value2;
+    Operand result;
+};
+
 // Intermediate Code Representation
 typedef struct icr Icr;
 
@@ -39,10 +76,25 @@ Icr * ICR_New();
 
 void ICR_Delete( Icr * icr );
 
+void ICR_SetCache( Icr * icr, Cache * cache );
+
 void ICR_Build( Icr * icr, Ast * ast );
 
 void ICR_Dump( Icr * icr );
 
+int ICR_GetSize( Icr * icr );
+
 void ICR_WriteToFile( Icr * icr, char * path );
 
+
+void ICR_ForEach( Icr * icr, void (*pfunc)( void *, void * ), void * context );
+
+char * ICR_GetFunctionName( Icr * icr, int function );
+
+int ICR_GetParamCount( Icr * icr, int function );
+
+int ICR_GetLocalCount( Icr * icr, int function );
+
+char * ICR_GetLocal( Icr * icr, int function, int local );
+
 #endif
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "intern.h"
+#include "arena.h"
+
+#define INTERN_INITIAL_SLOTS    1024
+
+typedef struct slot Slot;
+
+struct slot
+{
+    unsigned hash;
+    int length;
+    char * text;
+};
+
+// Open addressing with linear probing, never more than half full
+static Slot * slots = NULL;
+static unsigned nSlots = 0;
+static unsigned nUsed = 0;
+
+// Storage of the texts themselves
+static Arena * texts = NULL;
+
+// Parser threads intern concurrently, one lock covers the table and arena
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned ITN_Hash( const char * text, int length )
+{
+    // FNV-1a
+    unsigned hash = 2166136261u;
+    int i;
+    
+    for( i = 0; i < length; i++ )
+    {
+        hash ^= ( unsigned char )text[i];
+        hash *= 16777619u;
+    }
+    
+    return hash;
+}
+
+static void ITN_Grow()
+{
+    Slot * old = slots;
+    unsigned oldSize = nSlots;
+    unsigned i;
+    
+    nSlots = oldSize ? oldSize * 2 : INTERN_INITIAL_SLOTS;
+    slots = ( Slot* )calloc( nSlots, sizeof( Slot ) );
+    
+    for( i = 0; i < oldSize; i++ )
+    {
+        if( old[i].text )
+        {
+            unsigned j = old[i].hash & ( nSlots - 1 );
+            
+            while( slots[j].text )
+                j = ( j + 1 ) & ( nSlots - 1 );
+                
+            slots[j] = old[i];
+        }
+    }
+    
+    free( old );
+}
+
+char * ITN_Intern( const char * text, int length )
+{
+    unsigned hash = ITN_Hash( text, length );
+    char * copy;
+    
+    pthread_mutex_lock( &lock );
+    
+    if( 2 * ( nUsed + 1 ) > nSlots )
+        ITN_Grow();
+        
+    if( !texts )
+        texts = ARN_New();
+        
+    unsigned i = hash & ( nSlots - 1 );
+    
+    while( slots[i].text )
+    {
+        if( slots[i].hash == hash && slots[i].length == length && memcmp( slots[i].text, text, length ) == 0 )
+        {
+            copy = slots[i].text;
+            pthread_mutex_unlock( &lock );
+            
+            return copy;
+        }
+            
+        i = ( i + 1 ) & ( nSlots - 1 );
+    }
+    
+    copy = ARN_Strndup( texts, text, length );
+    
+    slots[i].hash = hash;
+    slots[i].length = length;
+    slots[i].text = copy;
+    nUsed++;
+    
+    pthread_mutex_unlock( &lock );
+    
+    return copy;
+}
+
+char * ITN_InternString( const char * text )
+{
+    return ITN_Intern( text, strlen( text ) );
+}
@@ -0,0 +1,13 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+// Global string interner. Equal texts always give the same pointer, so
+// interned strings are compared by address. They live until the end of
+// the compilation and must never be written to or freed. Safe to call
+// from several threads.
+
+char * ITN_Intern( const char * text, int length );
+
+char * ITN_InternString( const char * text );
+
+#endif
@@ -2,515 +2,531 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "lexer.h"
+#include "scan.h"
 
-#define LEXER_DEFAULT_BUFSIZE 32
+#define LEXER_READ_BLOCKSIZE  ( 1 << 16 )
 
-// Key strings
-#define S_DECIMAL   "1234567890"
-#define S_HEXA      "1234567890abcdefABCDEF"
-#define S_OPERATOR  ":><=+-*/" 
-#define S_PUNCT     "(),[]" 
-#define S_WHITESPC  " \t\n"
-#define S_ESCAPE    " \t\n\""
+// Character classes
+#define C_OTHER         0   // Anything not below, only valid inside strings and comments
+#define C_SPACE         1   // ' ', '\t' and '\0'
+#define C_NEWLINE       2
+#define C_LETTER        3   // Letters and '_' not listed below
+#define C_HEXLETTER     4   // a-f A-F
+#define C_X             5   // 'x', as in 0x
+#define C_N             6   // 'n', as in \n
+#define C_ZERO          7
+#define C_DIGIT         8
+#define C_QUOTE         9
+#define C_BACKSLASH     10
+#define C_SLASH         11
+#define C_STAR          12
+#define C_LESS          13
+#define C_GREATER       14
+#define C_EQUAL         15
+#define C_SINGLE        16  // Single char tokens: ':' '+' '-' '(' ')' ',' '[' ']'
+#define N_CLASSES       17
 
+// Scanner states. S_STOP means there is no transition and the lexeme is over.
+#define S_STOP          0
+#define S_START         1
+#define S_NEWLINE       2
+#define S_WORD          3   // Keyword or ID
+#define S_BADWORD       4   // Word with chars not allowed in IDs
+#define S_ZERO          5
+#define S_DECIMAL       6
+#define S_HEXA          7
+#define S_STRING        8
+#define S_STRINGESC     9
+#define S_STRINGEND     10
+#define S_STRINGBAD     11
+#define S_SLASH         12
+#define S_LINECOMMENT   13
+#define S_BLOCKCOMMENT  14
+#define S_BLOCKSTAR     15
+#define S_BLOCKEND      16
+#define S_LESS          17
+#define S_LESSEQ        18
+#define S_NEQ           19
+#define S_GREATER       20
+#define S_GREATEREQ     21
+#define S_SINGLE        22
+#define N_STATES        23
 
-char LEX_Peek( Lexer * lex );
+static const unsigned char charClass[256] =
+{
+    ['\0'] = C_SPACE, ['\t'] = C_SPACE, ['\n'] = C_NEWLINE, [' '] = C_SPACE,
+    ['"'] = C_QUOTE, ['('] = C_SINGLE, [')'] = C_SINGLE, ['*'] = C_STAR,
+    ['+'] = C_SINGLE, [','] = C_SINGLE, ['-'] = C_SINGLE, ['/'] = C_SLASH,
+    ['0'] = C_ZERO, ['1'] = C_DIGIT, ['2'] = C_DIGIT, ['3'] = C_DIGIT,
+    ['4'] = C_DIGIT, ['5'] = C_DIGIT, ['6'] = C_DIGIT, ['7'] = C_DIGIT,
+    ['8'] = C_DIGIT, ['9'] = C_DIGIT, [':'] = C_SINGLE, ['<'] = C_LESS,
+    ['='] = C_EQUAL, ['>'] = C_GREATER, ['A'] = C_HEXLETTER, ['B'] = C_HEXLETTER,
+    ['C'] = C_HEXLETTER, ['D'] = C_HEXLETTER, ['E'] = C_HEXLETTER, ['F'] = C_HEXLETTER,
+    ['G'] = C_LETTER, ['H'] = C_LETTER, ['I'] = C_LETTER, ['J'] = C_LETTER,
+    ['K'] = C_LETTER, ['L'] = C_LETTER, ['M'] = C_LETTER, ['N'] = C_LETTER,
+    ['O'] = C_LETTER, ['P'] = C_LETTER, ['Q'] = C_LETTER, ['R'] = C_LETTER,
+    ['S'] = C_LETTER, ['T'] = C_LETTER, ['U'] = C_LETTER, ['V'] = C_LETTER,
+    ['W'] = C_LETTER, ['X'] = C_LETTER, ['Y'] = C_LETTER, ['Z'] = C_LETTER,
+    ['['] = C_SINGLE, ['\\'] = C_BACKSLASH, [']'] = C_SINGLE, ['_'] = C_LETTER,
+    ['a'] = C_HEXLETTER, ['b'] = C_HEXLETTER, ['c'] = C_HEXLETTER, ['d'] = C_HEXLETTER,
+    ['e'] = C_HEXLETTER, ['f'] = C_HEXLETTER, ['g'] = C_LETTER, ['h'] = C_LETTER,
+    ['i'] = C_LETTER, ['j'] = C_LETTER, ['k'] = C_LETTER, ['l'] = C_LETTER,
+    ['m'] = C_LETTER, ['n'] = C_N, ['o'] = C_LETTER, ['p'] = C_LETTER,
+    ['q'] = C_LETTER, ['r'] = C_LETTER, ['s'] = C_LETTER, ['t'] = C_LETTER,
+    ['u'] = C_LETTER, ['v'] = C_LETTER, ['w'] = C_LETTER, ['x'] = C_X,
+    ['y'] = C_LETTER, ['z'] = C_LETTER,
+};
 
-char LEX_Get( Lexer * lex );
+// Whitespace is skipped before the scanner starts, so S_START never sees C_SPACE.
+// Rows of states that move on almost every class list all of them, in the
+// order of the classes.
+static const unsigned char transitions[N_STATES][N_CLASSES] =
+{
+    [S_START] = 
+    { 
+        [C_OTHER] = S_BADWORD, [C_NEWLINE] = S_NEWLINE, [C_LETTER] = S_WORD, [C_HEXLETTER] = S_WORD,
+        [C_X] = S_WORD, [C_N] = S_WORD, [C_ZERO] = S_ZERO, [C_DIGIT] = S_DECIMAL,
+        [C_QUOTE] = S_STRING, [C_BACKSLASH] = S_BADWORD, [C_SLASH] = S_SLASH, [C_STAR] = S_SINGLE,
+        [C_LESS] = S_LESS, [C_GREATER] = S_GREATER, [C_EQUAL] = S_SINGLE, [C_SINGLE] = S_SINGLE 
+    },
+    [S_WORD] = 
+    { 
+        [C_OTHER] = S_BADWORD, [C_LETTER] = S_WORD, [C_HEXLETTER] = S_WORD, [C_X] = S_WORD,
+        [C_N] = S_WORD, [C_ZERO] = S_WORD, [C_DIGIT] = S_WORD, [C_BACKSLASH] = S_BADWORD 
+    },
+    [S_BADWORD] = 
+    { 
+        [C_OTHER] = S_BADWORD, [C_LETTER] = S_BADWORD, [C_HEXLETTER] = S_BADWORD, [C_X] = S_BADWORD,
+        [C_N] = S_BADWORD, [C_ZERO] = S_BADWORD, [C_DIGIT] = S_BADWORD, [C_BACKSLASH] = S_BADWORD 
+    },
+    [S_ZERO] = { [C_X] = S_HEXA, [C_ZERO] = S_DECIMAL, [C_DIGIT] = S_DECIMAL },
+    [S_DECIMAL] = { [C_ZERO] = S_DECIMAL, [C_DIGIT] = S_DECIMAL },
+    [S_HEXA] = { [C_HEXLETTER] = S_HEXA, [C_ZERO] = S_HEXA, [C_DIGIT] = S_HEXA },
+    [S_STRING] = 
+    { 
+        S_STRING, S_STRING, S_STRINGBAD, S_STRING,
+        S_STRING, S_STRING, S_STRING, S_STRING,
+        S_STRING, S_STRINGEND, S_STRINGESC, S_STRING,
+        S_STRING, S_STRING, S_STRING, S_STRING,
+        S_STRING 
+    },
+    [S_STRINGESC] = 
+    { 
+        S_STRINGBAD, S_STRINGBAD, S_STRINGBAD, S_STRINGBAD,
+        S_STRINGBAD, S_STRINGBAD, S_STRING, S_STRINGBAD,
+        S_STRINGBAD, S_STRING, S_STRING, S_STRINGBAD,
+        S_STRINGBAD, S_STRINGBAD, S_STRINGBAD, S_STRINGBAD,
+        S_STRINGBAD 
+    },
+    [S_SLASH] = { [C_SLASH] = S_LINECOMMENT, [C_STAR] = S_BLOCKCOMMENT },
+    [S_LINECOMMENT] = 
+    { 
+        S_LINECOMMENT, S_LINECOMMENT, S_STOP, S_LINECOMMENT,
+        S_LINECOMMENT, S_LINECOMMENT, S_LINECOMMENT, S_LINECOMMENT,
+        S_LINECOMMENT, S_LINECOMMENT, S_LINECOMMENT, S_LINECOMMENT,
+        S_LINECOMMENT, S_LINECOMMENT, S_LINECOMMENT, S_LINECOMMENT,
+        S_LINECOMMENT 
+    },
+    [S_BLOCKCOMMENT] = 
+    { 
+        S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT,
+        S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT,
+        S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT,
+        S_BLOCKSTAR, S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT,
+        S_BLOCKCOMMENT 
+    },
+    [S_BLOCKSTAR] = 
+    { 
+        S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT,
+        S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT,
+        S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKEND,
+        S_BLOCKSTAR, S_BLOCKCOMMENT, S_BLOCKCOMMENT, S_BLOCKCOMMENT,
+        S_BLOCKCOMMENT 
+    },
+    [S_LESS] = { [C_EQUAL] = S_LESSEQ, [C_GREATER] = S_NEQ },
+    [S_GREATER] = { [C_EQUAL] = S_GREATEREQ },
+};
+
+// Token type of the lexeme when the scanner stops at each state
+static const int accepts[N_STATES] =
+{
+    [S_STOP] = T_ERROR,
+    [S_START] = T_ERROR,
+    [S_NEWLINE] = T_NL,
+    [S_WORD] = T_ID,
+    [S_BADWORD] = T_ERROR,
+    [S_ZERO] = T_LITINT,
+    [S_DECIMAL] = T_LITINT,
+    [S_HEXA] = T_LITINT,
+    [S_STRING] = T_ERROR,
+    [S_STRINGESC] = T_ERROR,
+    [S_STRINGEND] = T_LITSTRING,
+    [S_STRINGBAD] = T_ERROR,
+    [S_SLASH] = T_SLASH,
+    [S_LINECOMMENT] = T_COMMENT,
+    [S_BLOCKCOMMENT] = T_COMMENT,
+    [S_BLOCKSTAR] = T_COMMENT,
+    [S_BLOCKEND] = T_COMMENT,
+    [S_LESS] = T_SMALLER,
+    [S_LESSEQ] = T_SMALLEREQ,
+    [S_NEQ] = T_NEQ,
+    [S_GREATER] = T_LARGER,
+    [S_GREATEREQ] = T_LARGEREQ,
+    [S_SINGLE] = T_ERROR,
+};
 
-void LEX_AddToBuffer( Lexer * lex, char c );
+typedef struct keyword Keyword;
+
+struct keyword
+{
+    const char * word;
+    int length;
+    int type;
+};
+
+// Perfect hash of the reserved words, see KEYWORD_HASH
+#define KEYWORD_SLOTS 32
+
+static const Keyword keywords[KEYWORD_SLOTS] =
+{
+    [ 0] = { "fun", 3, T_FUN },
+    [ 1] = { "char", 4, T_CHAR },
+    [ 2] = { "while", 5, T_WHILE },
+    [ 3] = { "if", 2, T_IF },
+    [ 4] = { "return", 6, T_RETURN },
+    [ 7] = { "new", 3, T_NEW },
+    [ 8] = { "else", 4, T_ELSE },
+    [13] = { "int", 3, T_INT },
+    [17] = { "false", 5, T_FALSE },
+    [18] = { "not", 3, T_NOT },
+    [20] = { "string", 6, T_STRING },
+    [21] = { "and", 3, T_AND },
+    [22] = { "bool", 4, T_BOOL },
+    [23] = { "true", 4, T_TRUE },
+    [25] = { "end", 3, T_END },
+    [28] = { "loop", 4, T_LOOP },
+    [29] = { "or", 2, T_OR },
+};
 
-void LEX_ClearBuffer( Lexer * lex );
+// Collision free over T_IF..T_NOT. Must be redone if a reserved word is added.
+#define KEYWORD_HASH( w, n ) ( ( ( unsigned char )( w )[0] + 7 * ( unsigned char )( w )[( n ) - 1] + 8 * ( n ) ) & ( KEYWORD_SLOTS - 1 ) )
 
-Token * LEX_AllocToken( Lexer * lex, int type );
+// Where the source text comes from
+#define SOURCE_BUFFER   0   // Caller's buffer, not freed
+#define SOURCE_MAPPED   1   // File mapped with mmap
+#define SOURCE_READ     2   // File read in blocks into our own buffer
 
 struct lexer
 {
-    char * buffer;
-    int bufSize;
-    int bufUsed;
-    int ch;
+    const char * source;
+    const char * curr;
+    const char * end;
+    int sourceSize;
+    int sourceKind;
     int line;
-    bool peeked;
 };
 
-Lexer * LEX_New()
+static Lexer * LEX_Alloc( const char * source, int size, int kind )
 {
     Lexer* lex = malloc( sizeof( Lexer ) );
-    lex->bufSize = LEXER_DEFAULT_BUFSIZE;
-    lex->bufUsed = 0;
-    lex->buffer = malloc( lex->bufSize );
-    lex->buffer[0] = '\0';
+    lex->source = source;
+    lex->curr = source;
+    lex->end = source + size;
+    lex->sourceSize = size;
+    lex->sourceKind = kind;
     lex->line = 1;
-    lex->peeked = false;
     return lex;
 }
 
-void LEX_Delete( Lexer * lex )
+// Reads the whole file in large blocks, for when mmap is not possible
+// (pipes, empty files...)
+static char * LEX_ReadBlocks( int fd, int * outSize )
 {
-    free( lex->buffer );
-    free( lex );
-}
-
-char LEX_Peek( Lexer * lex )
-{
-    if( lex->peeked )	
-        return lex->ch;
-	
-    char c = getchar();
-    lex->ch = c;
-    lex->peeked = true;
-    return c;
-}
-
-char LEX_Get( Lexer * lex )
-{
-    if( lex->peeked )
+    int size = 0;
+    int capacity = LEXER_READ_BLOCKSIZE;
+    char * data = malloc( capacity );
+    
+    for( ;; )
     {
-        lex->peeked = false;
-        return lex->ch;
+        if( size == capacity )
+        {
+            capacity *= 2;
+            data = realloc( data, capacity );
+        }
+        
+        ssize_t nread = read( fd, data + size, capacity - size );
+        
+        if( nread < 0 )
+        {
+            free( data );
+            return NULL;
+        }
+        
+        if( nread == 0 )
+            break;
+            
+        size += nread;
     }
     
-    char c = getchar();
-    lex->ch = c;
-    return c;
+    *outSize = size;
+    return data;
 }
 
-void LEX_AddToBuffer( Lexer * lex, char c )
+Lexer * LEX_New( const char * path )
 {
-    lex->buffer[lex->bufUsed] = c;
-    lex->bufUsed++;
+    int fd = open( path, O_RDONLY );
     
-    if( lex->bufUsed == lex->bufSize )
+    if( fd < 0 )
+        return NULL;
+        
+    struct stat st;
+    
+    if( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 )
     {
-        lex->bufSize *= 2;
-        lex->buffer = realloc( lex->buffer, lex->bufSize );
+        void * data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        
+        if( data != MAP_FAILED )
+        {
+            madvise( data, st.st_size, MADV_SEQUENTIAL );
+            close( fd );
+            
+            return LEX_Alloc( data, st.st_size, SOURCE_MAPPED );
+        }
     }
     
-    lex->buffer[lex->bufUsed] = '\0';
+    int size = 0;
+    char * data = LEX_ReadBlocks( fd, &size );
+    close( fd );
+    
+    if( !data )
+        return NULL;
+    
+    return LEX_Alloc( data, size, SOURCE_READ );
 }
 
-void LEX_ClearBuffer( Lexer * lex )
+Lexer * LEX_NewFromBuffer( const char * buffer, int size )
 {
-    lex->bufUsed = 0;
-    lex->buffer[0] = '\0';
+    return LEX_Alloc( buffer, size, SOURCE_BUFFER );
 }
 
-Token * LEX_AllocToken( Lexer * lex, int type )
+// Lexer over part of a larger source, whose first line is the given one.
+// The span must start outside of any token or comment.
+Lexer * LEX_NewFromSpan( const char * buffer, int size, int line )
 {
-    Token * tok = TOK_New( lex->buffer, type, lex->line );
-    LEX_ClearBuffer( lex );
+    Lexer * lex = LEX_Alloc( buffer, size, SOURCE_BUFFER );
+    lex->line = line;
     
-    return tok;
+    return lex;
 }
 
-Token * LEX_NextToken( Lexer * lex )
+const char * LEX_GetSource( Lexer * lex, int * size )
 {
-    for( ;; ) 
-    {
-        char ch = LEX_Peek( lex );
+    *size = lex->sourceSize;
+    
+    return lex->source;
+}
 
-        // Whitespace        
-        while( strchr( S_WHITESPC, ch ) ) 
+// Finds the start of the next line, after the one at curr, that begins with
+// the fun keyword. Strings never span lines, so block comments are the only
+// state carried from one line to the next. curr must be outside of any
+// token or comment. Adds the newlines skipped to *line and returns end if
+// there is no such line.
+const char * LEX_FindFunction( const char * curr, const char * end, int * line )
+{
+    int inComment = 0;
+    
+    while( curr < end )
+    {
+        if( inComment )
         {
-            ch = LEX_Get( lex );
+            curr = SCN_FindCommentStop( curr, end );
             
-            if( ch == '\n' ) 
-            {
-                Token * tok = LEX_AllocToken( lex, T_NL );
-                lex->line++;
+            if( curr == end )
+                break;
                 
-                return tok;
+            if( *curr++ == '\n' )
+                ( *line )++;
+            else if( curr < end && *curr == '/' )
+            {
+                curr++;
+                inComment = 0;
             }
             
-            ch = LEX_Peek( lex );
+            continue;
         }
         
-        // Comments
-        if( ch == '/' ) 
+        switch( *curr++ )
         {
-            ch = LEX_Get( lex );
-            LEX_AddToBuffer( lex, ch );
-            char c = LEX_Peek( lex );
-            
-            if( c == '/' || c == '*' )
+            case '\n':
             {
-                for( ;; ) 
-                {
-                    ch = LEX_Get( lex );
+                const char * word;
+                
+                ( *line )++;
+                word = SCN_SkipSpaces( curr, end );
+                
+                if( end - word >= 3 && memcmp( word, "fun", 3 ) == 0 &&
+                    ( end - word == 3 || transitions[S_WORD][charClass[( unsigned char )word[3]]] == S_STOP ) )
+                    return curr;
                     
-                    // Line comment
-                    if( ch == '/' ) 
-                    {
-                        LEX_AddToBuffer( lex, ch );
-                        ch = LEX_Peek( lex );
-                        
-                        while( ch != '\n' && ch != EOF ) 
-                        {
-                            ch = LEX_Get( lex );
-                            LEX_AddToBuffer( lex, ch );
-                            ch = LEX_Peek( lex ); 
-                        }
-                        
-                        Token * tok = LEX_AllocToken( lex, T_COMMENT );
-                        //lex->line++;
-                        
-                        return tok;
-                    }
-                    // Nested comment
-                    else if( ch == '*' )
-                    {
-                        LEX_AddToBuffer( lex, ch );
-                                       
-                        for( ;; )
-                        {
-                            ch = LEX_Get( lex );
-                            
-                            if( ch == '\n' ) 
-                            {
-                                lex->line++;
-                            }
-                                
-                            while( ch != '*' ) 
-                            {
-                                if( ch == EOF )
-                                    return LEX_AllocToken( lex, T_COMMENT );
-                                    
-                                LEX_AddToBuffer( lex, ch );
-                                
-                                if( ch == '\n' )
-                                    lex->line++;                            
-                                
-                                ch = LEX_Get( lex );
-                            }                        
-                            
-                            LEX_AddToBuffer( lex, ch );
-                            ch = LEX_Peek( lex );
-                            
-                            if( ch == '/' )
-                            {
-                                ch = LEX_Get( lex );
-                                LEX_AddToBuffer( lex, ch );
-                                return LEX_AllocToken( lex, T_COMMENT );
-                            }
-                        }
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+                break;
             }
-        }
-        
-        if( ch == EOF ) 
-            return NULL; 
-            
-        // String        
-        if( ch == '"' ) 
-        {
-            ch = LEX_Get( lex );
-            //LEX_AddToBuffer( lex, ch );
             
-            for( ;; ) 
-            {
-                ch = LEX_Get( lex );
-                
-                if( ch == EOF ) 
-                {
-                    return LEX_AllocToken( lex, T_ERROR );
-                } 
-                else if( ch == '\\' ) 
+            case '"':
+                while( curr < end && *curr != '"' && *curr != '\n' )
                 {
-                    ch = LEX_Get( lex );
-                    
-                    if( ch == '\\' || ch == '"' ) 
-                    {
-                        LEX_AddToBuffer( lex, ch );
-                    }
-                    else if( ch == 'n' )
-                    {
-                        LEX_AddToBuffer( lex, '\n' );
-                    } 
-                    else 
-                    {
-                        return LEX_AllocToken( lex, T_ERROR );
-                    }
-                } 
-                else if( ch == '"' ) 
-                {
-                    //LEX_AddToBuffer( lex, ch );
-                    return LEX_AllocToken( lex, T_LITSTRING );
-                } 
-                else if( ch == '\n' ) 
-                {
-                    return LEX_AllocToken( lex, T_ERROR );
-                } 
-                else 
-                {
-                    LEX_AddToBuffer( lex, ch );
+                    if( *curr == '\\' && curr + 1 < end && curr[1] != '\n' )
+                        curr++;
+                        
+                    curr++;
                 }
-            }
-        }
-        
-        if( ch == EOF ) 
-            return NULL; 
-            
-        // Number
-        if( strchr( S_DECIMAL, ch ) ) 
-        {
-            bool isHexa = false;
-            ch = LEX_Get( lex );
-            
-            LEX_AddToBuffer( lex, ch );
-            
-            // Trata hexadecimal
-            if( ch == '0' )
-            {
-                ch = LEX_Peek( lex );
                 
-                if( ch == 'x' )
-                {                    
-                    ch = LEX_Get( lex );
-                    LEX_AddToBuffer( lex, ch );
+                if( curr < end && *curr == '"' )
+                    curr++;
                     
-                    isHexa = true;
-                }
-            }
-            
-            for( ;; ) 
-            {
-                ch = LEX_Peek( lex );
+                break;
                 
-                if( ch == EOF || strchr( S_ESCAPE, ch ) || ( isHexa && !strchr( S_HEXA, ch ) ) || ( !isHexa && !strchr( S_DECIMAL, ch ) ) ) 
-                {
-                    if( isHexa )
-                    {
-                        int value = strtol( lex->buffer, NULL, 16 );
-                        sprintf( lex->buffer, "%d", value );
-                    }
-                    
-                    return LEX_AllocToken( lex, T_LITINT );
-                }
-                else 
+            case '/':
+                if( curr < end && *curr == '/' )
+                    curr = SCN_FindNewline( curr, end );
+                else if( curr < end && *curr == '*' )
                 {
-                    ch = LEX_Get( lex );
-                    LEX_AddToBuffer( lex, ch );
+                    curr++;
+                    inComment = 1;
                 }
-            }
+                
+                break;
         }
+    }
+    
+    return end;
+}
+
+void LEX_Delete( Lexer * lex )
+{
+    if( lex->sourceKind == SOURCE_MAPPED )
+        munmap( ( void* )lex->source, lex->sourceSize );
+    else if( lex->sourceKind == SOURCE_READ )
+        free( ( void* )lex->source );
         
-        if( ch == EOF ) 
-            return NULL;       
+    free( lex );
+}
+
+static Token * LEX_AllocSpan( Lexer * lex, int type, const char * start, const char * end, int line )
+{
+    return TOK_New( lex->source, start - lex->source, end - start, type, line );
+}
+
+static int LEX_KeywordType( const char * word, int length )
+{
+    const Keyword * k = &keywords[KEYWORD_HASH( word, length )];
+    
+    if( k->length == length && memcmp( k->word, word, length ) == 0 )
+        return k->type;
         
-        // Punctuation
-        if( strchr( S_PUNCT, ch ) ) 
-        {
-            ch = LEX_Get( lex );
-            LEX_AddToBuffer( lex, ch );
+    return T_ID;
+}
+
+static int LEX_SingleType( char ch )
+{
+    switch( ch )
+    {
+        case ':':
+            return T_COLON;
+        case '+':
+            return T_PLUS;
+        case '-':
+            return T_MINUS;
+        case '*':
+            return T_ASTERISK;
+        case '=':
+            return T_EQ;
+        case '(':
+            return T_OCBRACKET;
+        case ')':
+            return T_CCBRACKET;
+        case ',':
+            return T_COMMA;
+        case '[':
+            return T_OSBRACKET;
+        case ']':
+            return T_CSBRACKET;
+        default:
+            return T_ERROR;
+    }
+}
+
+Token * LEX_NextToken( Lexer * lex )
+{
+    const char * curr = lex->curr;
+    const char * end = lex->end;
+    int state = S_START;
+    int newlines = 0;
+    
+    // Whitespace
+    curr = SCN_SkipSpaces( curr, end );
+    
+    const char * start = curr;
+    
+    // Longest match: run until there is no transition or the input is over
+    while( curr < end )
+    {
+        int cl = charClass[( unsigned char )*curr];
+        int next = transitions[state][cl];
+        
+        if( next == S_STOP )
+            break;
             
-            if( lex->bufUsed > 0 ) 
-            { 
-                if( strcmp( lex->buffer, "(" ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_OCBRACKET );
-                }
-                if( strcmp( lex->buffer, ")" ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_CCBRACKET );
-                }
-                if( strcmp( lex->buffer, "," ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_COMMA );
-                }
-                if( strcmp( lex->buffer, "[" ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_OSBRACKET );
-                }
-                if( strcmp( lex->buffer, "]" ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_CSBRACKET );
-                }
-            }
-        }
+        newlines += ( cl == C_NEWLINE );
+        state = next;
+        curr++;
         
-        // Operators
-        if( strchr( S_OPERATOR, ch ) )
+        // Long runs that can't change the state are skipped in bulk. Block
+        // comments stop at every newline so the count stays right.
+        switch( state )
         {
-            // Devido a leitura de '/' em comments, isso vem primeiro
-            if( strcmp( lex->buffer, "/" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_SLASH );
-            }
-                
-            ch = LEX_Get( lex );
-            LEX_AddToBuffer( lex, ch );
-            
-            if( ch == '<' )
-            {   
-                char c = LEX_Peek( lex );
+            case S_WORD:
+                curr = SCN_SkipWord( curr, end );
+                break;
                 
-                if( c == '=' )
-                {
-                    ch = LEX_Get( lex );
-                    LEX_AddToBuffer( lex, ch );
-                    return LEX_AllocToken( lex, T_SMALLEREQ );
-                }
-                else if( c == '>' )
-                {
-                    ch = LEX_Get( lex );
-                    LEX_AddToBuffer( lex, ch );
-                    return LEX_AllocToken( lex, T_NEQ );
-                }
+            case S_LINECOMMENT:
+                curr = SCN_FindNewline( curr, end );
+                break;
                 
-                return LEX_AllocToken( lex, T_SMALLER );
-            }            
-            else if( ch == '>' )
-            {
-                char c = LEX_Peek( lex );
-                
-                if( c == '=' )
-                {
-                    ch = LEX_Get( lex );
-                    LEX_AddToBuffer( lex, ch );
-                    return LEX_AllocToken( lex, T_LARGEREQ );
-                }
-                
-                return LEX_AllocToken( lex, T_LARGER );
-            }
-            else
-            {
-                if( strcmp( lex->buffer, ":" ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_COLON );
-                }
-                if( strcmp( lex->buffer, "+" ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_PLUS );
-                }
-                if( strcmp( lex->buffer, "-" ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_MINUS );
-                }
-                if( strcmp( lex->buffer, "*" ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_ASTERISK );
-                } 
-                if( strcmp( lex->buffer, "=" ) == 0 ) 
-                {
-                    return LEX_AllocToken( lex, T_EQ );
-                }               
-            }
+            case S_BLOCKCOMMENT:
+                curr = SCN_FindCommentStop( curr, end );
+                break;
+        }
+    }
+    
+    int line = lex->line;
+    
+    lex->curr = curr;
+    lex->line += newlines;
+    
+    switch( state )
+    {
+        case S_START:
+            return NULL;
             
-            // Nao tratou algum char em S_OPERATOR
-            return LEX_AllocToken( lex, T_ERROR );
-        }       
-        
-        // Keywords
-        while( !strchr( S_ESCAPE, ch ) && !strchr( S_OPERATOR, ch ) && !strchr( S_PUNCT, ch ) ) 
-        {
-            ch = LEX_Get( lex );
-            LEX_AddToBuffer( lex, ch );
-            ch = LEX_Peek( lex );
+        case S_WORD:
+            return LEX_AllocSpan( lex, LEX_KeywordType( start, curr - start ), start, curr, line );
             
-            if( ch == EOF ) 
-                return NULL;            
-        }
-
-        if( lex->bufUsed > 0 ) 
-        {            
-            if( strcmp( lex->buffer, "if" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_IF );
-            }
-            if( strcmp( lex->buffer, "else" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_ELSE );
-            }
-            if( strcmp( lex->buffer, "end" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_END );
-            }
-            if( strcmp( lex->buffer, "while" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_WHILE );
-            }
-            if( strcmp( lex->buffer, "loop" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_LOOP );
-            }
-            if( strcmp( lex->buffer, "fun" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_FUN );
-            }
-            if( strcmp( lex->buffer, "return" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_RETURN );
-            }
-            if( strcmp( lex->buffer, "new" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_NEW );
-            }
-            if( strcmp( lex->buffer, "string" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_STRING );
-            }
-            if( strcmp( lex->buffer, "int" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_INT );
-            }
-            if( strcmp( lex->buffer, "char" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_CHAR );
-            }
-            if( strcmp( lex->buffer, "bool" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_BOOL );
-            }
-            if( strcmp( lex->buffer, "true" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_TRUE );
-            }
-            if( strcmp( lex->buffer, "false" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_FALSE );
-            }
-            if( strcmp( lex->buffer, "and" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_AND );
-            }
-            if( strcmp( lex->buffer, "or" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_OR );
-            }
-            if( strcmp( lex->buffer, "not" ) == 0 ) 
-            {
-                return LEX_AllocToken( lex, T_NOT );
-            }
-        }
-        
-        char * tr = lex->buffer;
-        int i = 0;
-        
-        // ID's
-        if( tr[i] == '_' || ( ( tr[i] >= 'a' && tr[i] <= 'z' ) || ( tr[i] >= 'A' && tr[i] <= 'Z' ) ) )
-        {
-            for( i = 0; i < lex->bufUsed; ++i ) 
-            {          
-                if( !( tr[i] == '_' || ( ( tr[i] >= 'a' && tr[i] <= 'z' ) || ( tr[i] >= 'A' && tr[i] <= 'Z' ) || strchr( S_DECIMAL, tr[i] ) ) ) )
-                {                  
-                    return LEX_AllocToken( lex, T_ERROR );      
-                } 
-            }
+        case S_STRINGEND:
+            return LEX_AllocSpan( lex, T_LITSTRING, start + 1, curr - 1, line );
             
-            return LEX_AllocToken( lex, T_ID );
-        }
-        
-        if( ch == EOF ) 
-            return NULL;
+        case S_SINGLE:
+            return LEX_AllocSpan( lex, LEX_SingleType( *start ), start, curr, line );
+            
+        case S_NEWLINE:
+            return LEX_AllocSpan( lex, T_NL, curr, curr, line );
             
-        return LEX_AllocToken( lex, T_ERROR ); 
+        default:
+            return LEX_AllocSpan( lex, accepts[state], start, curr, line );
     }
 }
@@ -6,10 +6,18 @@
 typedef struct lexer Lexer;
 
 
-Lexer * LEX_New();
+Lexer * LEX_New( const char * path );
+
+Lexer * LEX_NewFromBuffer( const char * buffer, int size );
+
+Lexer * LEX_NewFromSpan( const char * buffer, int size, int line );
 
 void LEX_Delete( Lexer * lex );
 
 Token * LEX_NextToken( Lexer * lex );
 
+const char * LEX_GetSource( Lexer * lex, int * size );
+
+const char * LEX_FindFunction( const char * curr, const char * end, int * line );
+
 #endif
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 
 #include "list.h"
+#include "stats.h"
 
 
 typedef struct node Node;
@@ -15,6 +16,7 @@ struct node
 Node * NOD_New( void * info )
 {
     Node * node = ( Node* )malloc( sizeof( Node ) );
+    STS_CountAlloc();
     node->info = info;
     node->next = NULL;
     node->prev = NULL;
@@ -49,6 +51,7 @@ struct list
 List * LIS_New()
 {
     List * list = ( List* )malloc( sizeof( List ) );
+    STS_CountAlloc();
     list->first = NULL;
     list->last = NULL;
     list->current = NULL;
@@ -133,3 +136,28 @@ void LIS_Dump( List * list, void (*pfuncDump)( void * ) )
         list->current = list->current->next;
     }
 }
+
+void LIS_ForEach( List * list, void (*pfunc)( void *, void * ), void * context )
+{
+    Node * node;
+    
+    for( node = list->first; node != NULL; node = node->next )
+        (*pfunc)( node->info, context );
+}
+
+// Moves the entries of other to the end of list and deletes other
+void LIS_Append( List * list, List * other )
+{
+    if( other->size )
+    {
+        if( list->size )
+            list->last->next = other->first;
+        else
+            list->first = list->current = other->first;
+        
+        list->last = other->last;
+        list->size += other->size;
+    }
+    
+    free( other );
+}
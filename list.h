@@ -21,4 +21,8 @@ void * LIS_GetCurrent( List * list );
 
 void LIS_Dump( List * list, void (*pfuncDump)( void * ) );
 
+void LIS_ForEach( List * list, void (*pfunc)( void *, void * ), void * context );
+
+void LIS_Append( List * list, List * other );
+
 #endif
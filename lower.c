@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lower.h"
+
+typedef struct lowering Lowering;
+
+// Lists of the IR are built through their last element. Temps are
+// numbered across the program, so their addresses are kept by id.
+struct lowering
+{
+    Icr * icr;
+    IR * ir;
+    Function * function;    // NULL while lowering the globals
+    Function * lastFunction;
+    Variable * lastGlobal;
+    String * lastString;
+    int nStrings;
+    Instr * lastInstr;
+    Variable * lastTemp;
+    int nTemps;             // Temps of the function
+    int nScratch;           // Temps added by the lowering
+    Addr ret;               // $ret of the function, no str until used
+    Addr * temps;
+    int maxTemps;
+};
+
+static Addr LOW_Addr( AdType type, char * str, int num )
+{
+    Addr addr;
+
+    addr.type = type;
+    addr.str = str;
+    addr.num = num;
+    addr.nextUsage = -1;
+
+    return addr;
+}
+
+static char * LOW_Name( const char * prefix, int number )
+{
+    char * name = ( char* )malloc( strlen( prefix ) + 12 );
+
+    sprintf( name, "%s%d", prefix, number );
+
+    return name;
+}
+
+static Addr LOW_AddTemp( Lowering * low, char * name )
+{
+    Variable * temp = Variable_new( name );
+
+    if( low->lastTemp )
+        low->lastTemp->next = temp;
+    else
+        low->function->temps = temp;
+
+    low->lastTemp = temp;
+
+    return LOW_Addr( AD_TEMP, name, low->nTemps++ );
+}
+
+// Holds a value the .ic writes in place, as an element or as an operand of
+// a store to an element
+static Addr LOW_Scratch( Lowering * low )
+{
+    return LOW_AddTemp( low, LOW_Name( "$l", low->nScratch++ ) );
+}
+
+static Addr LOW_Temp( Lowering * low, int id )
+{
+    if( id >= low->maxTemps )
+    {
+        int maxTemps = low->maxTemps ? 2 * low->maxTemps : 256;
+
+        while( id >= maxTemps )
+            maxTemps *= 2;
+
+        low->temps = ( Addr* )realloc( low->temps, maxTemps * sizeof( Addr ) );
+        memset( &low->temps[low->maxTemps], 0, ( maxTemps - low->maxTemps ) * sizeof( Addr ) );
+        low->maxTemps = maxTemps;
+    }
+
+    if( !low->temps[id].str )
+        low->temps[id] = LOW_AddTemp( low, LOW_Name( "$t", id ) );
+
+    return low->temps[id];
+}
+
+// The .ic keeps strings in place, the backend declares them apart
+static char * LOW_Quote( char * text )
+{
+    char * quoted = ( char* )malloc( 4 * strlen( text ) + 3 );
+    char * curr = quoted;
+
+    *curr++ = '"';
+
+    for( ; *text; text++ )
+    {
+        unsigned char c = ( unsigned char )*text;
+
+        if( c == '"' || c == '\\' )
+        {
+            *curr++ = '\\';
+            *curr++ = c;
+        }
+        else if( c == '\n' )
+        {
+            *curr++ = '\\';
+            *curr++ = 'n';
+        }
+        else if( c == '\t' )
+        {
+            *curr++ = '\\';
+            *curr++ = 't';
+        }
+        else if( c < ' ' || c == 127 )
+        {
+            sprintf( curr, "\\%03o", c );
+            curr += 4;
+        }
+        else
+        {
+            *curr++ = c;
+        }
+    }
+
+    *curr++ = '"';
+    *curr = '\0';
+
+    return quoted;
+}
+
+static Addr LOW_String( Lowering * low, char * text )
+{
+    String * str = String_new( LOW_Name( ".S", low->nStrings ), LOW_Quote( text ) );
+
+    if( low->lastString )
+        low->lastString->next = str;
+    else
+        low->ir->strings = str;
+
+    low->lastString = str;
+
+    return LOW_Addr( AD_STRING, ( char* )str->name, low->nStrings++ );
+}
+
+// Address of the operand itself, whether or not it is indexed
+static Addr LOW_Address( Lowering * low, Operand * o )
+{
+    switch( o->kind )
+    {
+        case D_TEMP:
+            return LOW_Temp( low, o->id );
+
+        case D_LOCAL:
+            return LOW_Addr( AD_LOCAL, o->name, o->id );
+
+        case D_GLOBAL:
+            return LOW_Addr( AD_GLOBAL, o->name, o->id );
+
+        case D_NUMBER:
+            return Addr_litNum( o->id );
+
+        case D_STRING:
+            return LOW_String( low, o->name );
+
+        case D_LABEL:
+            return Addr_label( LOW_Name( ".L", o->id ) );
+
+        case D_FUNCTION:
+            return Addr_function( o->name );
+
+        case D_RET:
+        {
+            if( !low->ret.str )
+                low->ret = LOW_AddTemp( low, "$ret" );
+
+            return low->ret;
+        }
+    }
+
+    return LOW_Addr( AD_UNSET, NULL, 0 );
+}
+
+static void LOW_Emit( Lowering * low, Instr * instr )
+{
+    if( low->lastInstr )
+        low->lastInstr->next = instr;
+    else
+        low->function->code = instr;
+
+    low->lastInstr = instr;
+}
+
+// An element is read into a temp before it is used as a value
+static Addr LOW_Value( Lowering * low, Operand * o )
+{
+    if( !o->index )
+        return LOW_Address( low, o );
+
+    Addr base = LOW_Address( low, o );
+    Addr index = LOW_Value( low, o->index );
+    Addr temp = LOW_Scratch( low );
+
+    LOW_Emit( low, Instr_new( o->isByte ? OP_SET_IDX_BYTE : OP_SET_IDX, temp, base, index ) );
+
+    return temp;
+}
+
+// Where an entry puts its result. An element gets it through a temp,
+// stored by LOW_Store.
+static Addr LOW_Target( Lowering * low, Operand * o )
+{
+    return o->index ? LOW_Scratch( low ) : LOW_Address( low, o );
+}
+
+static void LOW_Store( Lowering * low, Operand * o, Addr value, int isByte )
+{
+    if( !o->index )
+        return;
+
+    Addr base = LOW_Address( low, o );
+    Addr index = LOW_Value( low, o->index );
+
+    LOW_Emit( low, Instr_new( isByte ? OP_IDX_SET_BYTE : OP_IDX_SET, base, index, value ) );
+}
+
+static void LOW_OpenFunction( Lowering * low, int function )
+{
+    Icr * icr = low->icr;
+    int nLocals = ICR_GetLocalCount( icr, function );
+    Variable * last = NULL;
+    int i;
+
+    low->function = Function_new( ICR_GetFunctionName( icr, function ), NULL );
+
+    // Parameters are the first locals, counted as arguments of the function
+    for( i = 0; i < nLocals; i++ )
+    {
+        Variable * local = Variable_new( ICR_GetLocal( icr, function, i ) );
+
+        if( last )
+            last->next = local;
+        else
+            low->function->locals = local;
+
+        last = local;
+    }
+
+    low->function->nArgs = ICR_GetParamCount( icr, function );
+
+    if( low->lastFunction )
+        low->lastFunction->next = low->function;
+    else
+        low->ir->functions = low->function;
+
+    low->lastFunction = low->function;
+    low->lastInstr = NULL;
+    low->lastTemp = NULL;
+    low->nTemps = 0;
+    low->ret.str = NULL;
+}
+
+// Globals are declared by the entries before the first function, which
+// the backend has no code for
+static void LOW_Global( Lowering * low, Entry * e )
+{
+    if( e->operation != O_ASGN || e->result.kind != D_GLOBAL )
+        return;
+
+    Variable * global = Variable_new( e->result.name );
+
+    if( low->lastGlobal )
+        low->lastGlobal->next = global;
+    else
+        low->ir->globals = global;
+
+    low->lastGlobal = global;
+}
+
+static Opcode LOW_Operation( int operation )
+{
+    switch( operation )
+    {
+        case O_ADD:
+            return OP_ADD;
+        case O_SUB:
+            return OP_SUB;
+        case O_MUL:
+            return OP_MUL;
+        case O_DIV:
+            return OP_DIV;
+        case O_EQ:
+            return OP_EQ;
+        case O_NEQ:
+            return OP_NE;
+        case O_LRGR:
+            return OP_GT;
+        case O_SMLR:
+            return OP_LT;
+        case O_LRGRE:
+            return OP_GE;
+        default:
+            return OP_LE;
+    }
+}
+
+static void LOW_Entry( void * entry, void * lowering )
+{
+    Entry * e = ( Entry* )entry;
+    Lowering * low = ( Lowering* )lowering;
+
+    if( e->operation == O_FUN )
+    {
+        LOW_OpenFunction( low, e->value1.id );
+        return;
+    }
+
+    if( !low->function )
+    {
+        LOW_Global( low, e );
+        return;
+    }
+
+    switch( e->operation )
+    {
+        case O_LABL:
+            LOW_Emit( low, Instr_new( OP_LABEL, LOW_Address( low, &e->value1 ) ) );
+            break;
+
+        case O_GOTO:
+            LOW_Emit( low, Instr_new( OP_GOTO, LOW_Address( low, &e->value1 ) ) );
+            break;
+
+        case O_IFT:
+        case O_IFF:
+        {
+            Addr cond = LOW_Value( low, &e->value1 );
+
+            LOW_Emit( low, Instr_new( e->operation == O_IFT ? OP_IF : OP_IF_FALSE, cond, LOW_Address( low, &e->result ) ) );
+        }
+            break;
+
+        case O_PARM:
+            LOW_Emit( low, Instr_new( OP_PARAM, LOW_Value( low, &e->value1 ) ) );
+            break;
+
+        case O_CALL:
+        {
+            int nArgs = e->value1.id >= 0 ? ICR_GetParamCount( low->icr, e->value1.id ) : 0;
+
+            LOW_Emit( low, Instr_new( OP_CALL, Addr_function( e->value1.name ), Addr_litNum( nArgs ) ) );
+        }
+            break;
+
+        case O_RET:
+        {
+            if( e->value1.kind == D_NONE )
+                LOW_Emit( low, Instr_new( OP_RET ) );
+            else
+                LOW_Emit( low, Instr_new( OP_RET_VAL, LOW_Value( low, &e->value1 ) ) );
+        }
+            break;
+
+        case O_NEW:
+        {
+            Addr size = LOW_Value( low, &e->value1 );
+            Addr target = LOW_Target( low, &e->result );
+
+            LOW_Emit( low, Instr_new( OP_NEW, target, size ) );
+            LOW_Store( low, &e->result, target, 0 );
+        }
+            break;
+
+        case O_ASGN:
+        {
+            // x = y[i] is one instruction, x[i] = y[j] goes through a temp
+            if( e->value1.index && !e->result.index )
+            {
+                Addr base = LOW_Address( low, &e->value1 );
+                Addr index = LOW_Value( low, e->value1.index );
+
+                LOW_Emit( low, Instr_new( e->value1.isByte ? OP_SET_IDX_BYTE : OP_SET_IDX, LOW_Address( low, &e->result ), base, index ) );
+            }
+            else if( e->result.index )
+            {
+                LOW_Store( low, &e->result, LOW_Value( low, &e->value1 ), e->value1.isByte );
+            }
+            else
+            {
+                Addr value = LOW_Value( low, &e->value1 );
+
+                LOW_Emit( low, Instr_new( e->value1.isByte ? OP_SET_BYTE : OP_SET, LOW_Address( low, &e->result ), value ) );
+            }
+        }
+            break;
+
+        default:
+        {
+            Addr v1 = LOW_Value( low, &e->value1 );
+            Addr v2 = LOW_Value( low, &e->value2 );
+            Addr target = LOW_Target( low, &e->result );
+
+            LOW_Emit( low, Instr_new( LOW_Operation( e->operation ), target, v1, v2 ) );
+            LOW_Store( low, &e->result, target, 0 );
+        }
+            break;
+    }
+}
+
+IR * LOW_Lower( Icr * icr )
+{
+    Lowering low;
+
+    memset( &low, 0, sizeof( Lowering ) );
+    low.icr = icr;
+    low.ir = IR_new();
+
+    ICR_ForEach( icr, &LOW_Entry, &low );
+
+    free( low.temps );
+
+    return low.ir;
+}
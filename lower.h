@@ -0,0 +1,13 @@
+#ifndef LOWER_H
+#define LOWER_H
+
+#include "icr.h"
+#include "backend/ir.h"
+
+// Lowers the intermediate code into the backend's IR, as the backend would
+// have read it from the .ic, so that it is assembled in the same process.
+
+
+IR * LOW_Lower( Icr * icr );
+
+#endif
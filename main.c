@@ -1,11 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lexer.h"
+#include "stream.h"
 #include "parser.h"
 #include "ast.h"
 #include "symtable.h"
 #include "icr.h"
+#include "cache.h"
+#include "lower.h"
+#include "backend/assembler.h"
+#include "stats.h"
 
 
 void errorLexer( Token * tok )
@@ -17,64 +23,160 @@ void errorLexer( Token * tok )
 
 int main( int argc, char * argv[] )
 {
-	if( argc < 2 )
+    char * path = NULL;
+    int jobs = 1;
+    int incremental = 0;
+    int assemble = 0;
+    int binary = 0;
+    int i;
+    
+    for( i = 1; i < argc; i++ )
+    {
+        if( strcmp( argv[i], "--stats" ) == 0 )
+            STS_Enable();
+        else if( strcmp( argv[i], "--jobs" ) == 0 && i + 1 < argc )
+            jobs = atoi( argv[++i] );
+        else if( strcmp( argv[i], "--incremental" ) == 0 )
+            incremental = 1;
+        else if( strcmp( argv[i], "--asm" ) == 0 )
+            assemble = 1;
+        else if( strcmp( argv[i], "--ir" ) == 0 )
+            binary = 1;
+        else
+            path = argv[i];
+    }
+    
+	if( !path )
 	{
 	    printf( "Not enough arguments.\n" );
 		return EXIT_FAILURE;
 	}
 		
-	Lexer * lex = LEX_New();
-	List * tokens = LIS_New();	
-	
-	FILE* fp = freopen( argv[1], "r", stdin );
-	if( !fp )
+	Lexer * lex = LEX_New( path );
+	if( !lex )
 	{
 	    printf( "File doesn't exist.\n" );
 		return EXIT_FAILURE;
 	}
 	
-    for( ;; ) 
+	// Lexing runs inside parsing, so both are one phase
+	STS_Begin( "lex+parse" );
+    Parser * par = PAR_New();    
+    
+    if( jobs > 1 )
     {
-        Token * tok = LEX_NextToken( lex );
-        
-        if( !tok )         
-            break;
-            
-        if( TOK_GetType( tok ) == T_ERROR )
-        {
-            LIS_Delete( tokens, &TOK_Delete );
-            LEX_Delete( lex );
-            errorLexer( tok );
-        }
+        PAR_ExecuteParallel( par, lex, &errorLexer, jobs );
+    }
+    else
+    {
+        TokenStream * tokens = TKS_New( lex, &errorLexer );
+        PAR_Execute( par, tokens );
         
-        if( TOK_GetType( tok ) == T_COMMENT )
-        {
-            TOK_Delete( tok );
-            continue;
-        }              
-
-        LIS_PushBack( tokens, tok );
+        // Tokens point into the lexer's source, so it outlives the stream
+        TKS_Delete( tokens );
     }
     
-    LEX_Delete( lex );
-    
-    Parser * par = PAR_New();    
-    PAR_Execute( par, tokens );   
     Ast * ast = PAR_GetAst( par );
+    STS_End( "lex+parse" );
+    STS_Count( "lex+parse", "tokens", PAR_GetTokenCount( par ) );
+    STS_Count( "lex+parse", "nodes", AST_GetSize( ast ) );
     PAR_Delete( par );    
+    LEX_Delete( lex );
+    
+    // Functions unchanged since the last --incremental run of path are
+    // neither checked nor generated again
+    Cache * cache = NULL;
+    char * cachePath = NULL;
+    
+    if( incremental )
+    {
+        cachePath = ( char* )malloc( strlen( path ) + 7 );
+        sprintf( cachePath, "%s.cache", path );
+        cache = CCH_Load( cachePath );
+    }
     
+    STS_Begin( "typing" );
     SymTable * syt = SYT_New();
-    SYT_Build( syt, ast );
+    SYT_SetCache( syt, cache );
+    
+    if( jobs > 1 )
+        SYT_BuildParallel( syt, ast, jobs );
+    else
+        SYT_Build( syt, ast );
+        
+    STS_End( "typing" );
+    STS_Count( "typing", "symbols", SYT_GetSymbolCount( syt ) );
+    
+    if( cache )
+        STS_Count( "typing", "cached functions", CCH_GetHitCount( cache ) );
+        
     SYT_Delete( syt );
     
+    STS_Begin( "dump" );
     AST_Dump( ast );
+    STS_End( "dump" );
         
+    STS_Begin( "ir" );
     Icr * icr = ICR_New();    
+    ICR_SetCache( icr, cache );
     ICR_Build( icr, ast );
+    AST_Delete( ast );
+    STS_End( "ir" );
+    STS_Count( "ir", "entries", ICR_GetSize( icr ) );
+    
+    // Long enough for the longest suffix, ".irb"
+    size_t outSize = strlen( path ) + 5;
+    char * outPath = ( char* )malloc( outSize );
+    
+    // --asm hands the code to the backend in memory instead of through the
+    // .ic, the backend writes <path>.s. --ir keeps the lowered code in
+    // <path>.irb, which the backend maps without parsing.
+    if( assemble || binary )
+    {
+        STS_Begin( "lower" );
+        IR * ir = LOW_Lower( icr );
+        STS_End( "lower" );
+        
+        if( binary )
+        {
+            STS_Begin( "write" );
+            snprintf( outPath, outSize, "%s.irb", path );
+            
+            if( !IR_save( ir, outPath ) )
+            {
+                fprintf( stderr, "!IR Error: Could not write \'%s\'.\n", outPath );
+                exit( EXIT_FAILURE );
+            }
+            
+            STS_End( "write" );
+        }
+        
+        if( assemble )
+        {
+            snprintf( outPath, outSize, "%s.s", path );
+            Assembler * assembler = ASM_New();
+            ASM_Build( assembler, ir, outPath );
+            ASM_Delete( assembler );
+        }
+    }
+    else
+    {
+        STS_Begin( "write" );
+        snprintf( outPath, outSize, "%s.ic", path ); 
+        ICR_WriteToFile( icr, outPath );   
+        STS_End( "write" );
+    }
+    
+    free( outPath );
+    
+    if( cache )
+    {
+        CCH_Save( cache, cachePath );
+        CCH_Delete( cache );
+        free( cachePath );
+    }
     
-    char path[64];
-    sprintf( path, "%s.ic", argv[1] ); 
-    ICR_WriteToFile( icr, path );   
+    STS_Report();
     
 	return EXIT_SUCCESS;
 }
@@ -1,8 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <setjmp.h>
+#include <pthread.h>
 
 #include "parser.h"
 
+// Smallest span of source worth a parallel segment of its own
+#define PAR_MIN_SEGMENT     ( 1 << 16 )
+// Segments per job, so that threads finishing early take more work
+#define PAR_SEGMENTS_PER_JOB    8
+
 
 Ast * PAR_ExpandBlock( Parser * par );
 Ast * PAR_ExpandVar( Parser * par );
@@ -11,27 +18,49 @@ Ast * PAR_ExpandExp( Parser * par );
 
 struct parser
 {
-    List * tokens;
+    TokenStream * tokens;
     Ast * ast;
-    Token * lastMatched;
+    int lastLine;
+    int nTokens;
 };
 
-int PAR_Peek( Parser * par )
+// Set while a segment is parsed on a worker thread. Syntax and lexing
+// errors then jump back to the worker instead of exiting.
+static __thread jmp_buf * recovery = NULL;
+
+static inline int PAR_Peek( Parser * par )
+{
+    return TKS_Peek( par->tokens, 0 );
+}
+
+// The matched token is only valid until the next match
+Token * PAR_Match( Parser * par, int type )
 {
-    return LIS_Peek( par->tokens, &TOK_GetType );
+    Token * matched = TKS_Match( par->tokens, type );
+    
+    if( type != T_NL )
+        par->lastLine = TOK_GetLine( matched );
+        
+    return matched;
 }
 
-void PAR_Match( Parser * par, int type )
+// Matches an ID into a single node tree, to be prepended where it belongs
+Ast * PAR_MatchId( Parser * par )
 {
-    Token * lastMatched = LIS_Match( par->tokens, type, &TOK_IsType, &TOK_MatchError );
+    Token * matched = PAR_Match( par, T_ID );
+    Ast * id = AST_NewFrom( par->ast );
+    
+    AST_AppendChildNode( id, A_ID, TOK_GetText( matched ), TOK_GetLine( matched ) );
     
-    if( TOK_GetType( lastMatched ) != T_NL )
-        par->lastMatched = lastMatched;
+    return id;
 }
 
 void PAR_Error( Parser * par, const char * expected, const char * tip )
 {
-    Token * curr = ( Token* )LIS_GetCurrent( par->tokens );
+    if( recovery )
+        longjmp( *recovery, 1 );
+        
+    Token * curr = TKS_PeekToken( par->tokens, 0 );
     
     if( curr )
     {
@@ -59,28 +88,28 @@ void PAR_ExpandNewLine( Parser * par )
 Ast * PAR_ExpandBaseType( Parser * par )
 {
     //printf("PAR: BaseType\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     int peeked = PAR_Peek( par );
         
     if( peeked == T_STRING )
     {
         PAR_Match( par, T_STRING );
-        AST_AppendChildNode( ast, A_TYPE, "string", TOK_GetLine( par->lastMatched ) );
+        AST_AppendChildNode( ast, A_TYPE, "string", par->lastLine );
     }
     else if( peeked == T_CHAR )
     {
         PAR_Match( par, T_CHAR );
-        AST_AppendChildNode( ast, A_TYPE, "char", TOK_GetLine( par->lastMatched ) );
+        AST_AppendChildNode( ast, A_TYPE, "char", par->lastLine );
     }
     else if( peeked == T_INT )
     {
         PAR_Match( par, T_INT );
-        AST_AppendChildNode( ast, A_TYPE, "int", TOK_GetLine( par->lastMatched ) );        
+        AST_AppendChildNode( ast, A_TYPE, "int", par->lastLine );        
     }
     else if( peeked == T_BOOL )
     {
         PAR_Match( par, T_BOOL );
-        AST_AppendChildNode( ast, A_TYPE, "bool", TOK_GetLine( par->lastMatched ) );        
+        AST_AppendChildNode( ast, A_TYPE, "bool", par->lastLine );        
     }
     else
     {
@@ -93,15 +122,15 @@ Ast * PAR_ExpandBaseType( Parser * par )
 Ast * PAR_ExpandType( Parser * par )
 {
     //printf("PAR: Type\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     
-    AST_AppendChildNode( ast, A_TYPE, NULL, TOK_GetLine( par->lastMatched ) );
+    AST_AppendChildNode( ast, A_TYPE, NULL, par->lastLine );
         
     while( PAR_Peek( par ) == T_OSBRACKET )
     {
         PAR_Match( par, T_OSBRACKET );
         PAR_Match( par, T_CSBRACKET );
-        AST_AppendChildNode( ast, A_TYPE, "[]", TOK_GetLine( par->lastMatched ) );        
+        AST_AppendChildNode( ast, A_TYPE, "[]", par->lastLine );        
     }
     
     AST_AppendChildTree( ast, PAR_ExpandBaseType( par ) );
@@ -112,10 +141,10 @@ Ast * PAR_ExpandType( Parser * par )
 Ast * PAR_ExpandDeclVar( Parser * par )
 {
     //printf("PAR: DeclVar\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
         
     PAR_Match( par, T_COLON );
-    AST_AppendChildNode( ast, A_DECLVAR, NULL, TOK_GetLine( par->lastMatched ) );
+    AST_AppendChildNode( ast, A_DECLVAR, NULL, par->lastLine );
     AST_AppendChildTree( ast, PAR_ExpandType( par ) );
     
     return ast;
@@ -125,13 +154,10 @@ Ast * PAR_ExpandGlobal( Parser * par )
 {
     //printf("PAR: Global\n");
     Ast * ast;
-    Token * matchedId;
-    
-    PAR_Match( par, T_ID );
-    matchedId = par->lastMatched;
+    Ast * id = PAR_MatchId( par );
     
     ast = PAR_ExpandDeclVar( par );
-    AST_PrependChildNode( ast, A_ID, TOK_GetText( matchedId ), TOK_GetLine( matchedId ) );
+    AST_PrependChildTree( ast, id );
     
     PAR_Match( par, T_NL );
     
@@ -142,13 +168,10 @@ Ast * PAR_ExpandParam( Parser * par )
 {
     //printf("PAR: Param\n");
     Ast * ast;
-    Token * matchedId;
-        
-    PAR_Match( par, T_ID ); 
-    matchedId = par->lastMatched;
+    Ast * id = PAR_MatchId( par );
        
     ast = PAR_ExpandDeclVar( par );
-    AST_PrependChildNode( ast, A_ID, TOK_GetText( matchedId ), TOK_GetLine( matchedId ) );
+    AST_PrependChildTree( ast, id );
     
     return ast;
 }
@@ -156,8 +179,8 @@ Ast * PAR_ExpandParam( Parser * par )
 Ast * PAR_ExpandParams( Parser * par )
 {
     //printf("PAR: Params\n");    
-    Ast * ast = AST_New();
-    AST_AppendChildNode( ast, A_PARAMS, NULL, TOK_GetLine( par->lastMatched ) );
+    Ast * ast = AST_NewFrom( par->ast );
+    AST_AppendChildNode( ast, A_PARAMS, NULL, par->lastLine );
     
     AST_AppendChildTree( ast, PAR_ExpandParam( par ) );
         
@@ -172,14 +195,13 @@ Ast * PAR_ExpandParams( Parser * par )
 
 Ast * PAR_ExpandExpTerminal( Parser * par )
 {
-    Ast * ast = AST_New();    
-    Token * matchedId;
+    Ast * ast = AST_NewFrom( par->ast );    
+    Ast * id;
     int peeked = PAR_Peek( par );
     
     if( peeked == T_ID )
     {
-        PAR_Match( par, T_ID );
-        matchedId = par->lastMatched;
+        id = PAR_MatchId( par );
         
         if( PAR_Peek( par ) == T_OCBRACKET )
         {
@@ -190,22 +212,22 @@ Ast * PAR_ExpandExpTerminal( Parser * par )
             AST_AppendChildTree( ast, PAR_ExpandVar( par ) );
         }  
         
-        AST_PrependChildNode( ast, A_ID, TOK_GetText( matchedId ), TOK_GetLine( matchedId ) );  
+        AST_PrependChildTree( ast, id );  
     }
     else if( peeked == T_LITINT || peeked == T_LITSTRING )
     {
-        PAR_Match( par, peeked );
-        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), TOK_GetText( par->lastMatched ), TOK_GetLine( par->lastMatched ) );
+        Token * matched = PAR_Match( par, peeked );
+        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), TOK_GetText( matched ), TOK_GetLine( matched ) );
     }
     else if( peeked == T_TRUE || peeked == T_FALSE )
     {
         PAR_Match( par, peeked );
-        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), NULL, TOK_GetLine( par->lastMatched ) );
+        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), NULL, par->lastLine );
     }       
     else if( peeked == T_NEW )
     {
         PAR_Match( par, T_NEW );
-        AST_AppendChildNode( ast, A_NEW, NULL, TOK_GetLine( par->lastMatched ) );
+        AST_AppendChildNode( ast, A_NEW, NULL, par->lastLine );
         
         PAR_Match( par, T_OSBRACKET );
         AST_AppendChildTree( ast, PAR_ExpandExp( par ) );
@@ -228,155 +250,104 @@ Ast * PAR_ExpandExpTerminal( Parser * par )
 
 Ast * PAR_ExpandExpUnary( Parser * par )
 {
-    Ast * ast = AST_New();    
+    Ast * ast;    
     int peeked;    
     
     peeked = PAR_Peek( par );
     
     if( peeked == T_NOT  )
     {
+        ast = AST_NewFrom( par->ast );
         PAR_Match( par, peeked );
-        AST_AppendChildNode( ast, A_NOT, NULL, TOK_GetLine( par->lastMatched ) );        
+        AST_AppendChildNode( ast, A_NOT, NULL, par->lastLine );        
             
         AST_AppendChildTree( ast, PAR_ExpandExpUnary( par ) );
     }
     else if( peeked == T_MINUS )
     {
+        ast = AST_NewFrom( par->ast );
         PAR_Match( par, peeked );
-        AST_AppendChildNode( ast, A_NEGATIVE, NULL, TOK_GetLine( par->lastMatched ) );        
+        AST_AppendChildNode( ast, A_NEGATIVE, NULL, par->lastLine );        
             
         AST_AppendChildTree( ast, PAR_ExpandExpUnary( par ) );
     }
     else
     {
-        AST_AppendChildTree( ast, PAR_ExpandExpTerminal( par ) );
+        ast = PAR_ExpandExpTerminal( par );
     }
     
     return ast;
 }
 
-Ast * PAR_ExpandExpB( Parser * par )
+// Precedence of binary operators, lowest first. 0 if the token is not one.
+static int PAR_BinaryPrecedence( int tokenType )
 {
-    Ast * ast = AST_New();
-    Ast * branch;
-    int peeked;
-    
-    branch = PAR_ExpandExpUnary( par );
-    peeked = PAR_Peek( par );
-    
-    if( peeked == T_ASTERISK || peeked == T_SLASH )
+    switch( tokenType )
     {
-        PAR_Match( par, peeked );
-        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), NULL, TOK_GetLine( par->lastMatched ) );        
+        case T_OR:
+            return 1;
             
-        AST_AppendChildTree( ast, PAR_ExpandExpB( par ) );
-    }
-    
-    AST_PrependChildTree( ast, branch );
-    
-    return ast;
-}
-
-Ast * PAR_ExpandExpA( Parser * par )
-{
-    Ast * ast = AST_New();
-    Ast * branch;
-    int peeked;
-    
-    branch = PAR_ExpandExpB( par );
-    peeked = PAR_Peek( par );
-    
-    if( peeked == T_PLUS || peeked == T_MINUS )
-    {
-        PAR_Match( par, peeked );
-        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), NULL, TOK_GetLine( par->lastMatched ) );        
+        case T_AND:
+            return 2;
             
-        AST_AppendChildTree( ast, PAR_ExpandExpA( par ) );
-    }
-    
-    AST_PrependChildTree( ast, branch );
-    
-    return ast;
-}
-
-Ast * PAR_ExpandExpCmp( Parser * par )
-{
-    Ast * ast = AST_New();
-    Ast * branch;
-    int peeked;
-    
-    branch = PAR_ExpandExpA( par );
-    peeked = PAR_Peek( par );
-    
-    if( peeked == T_EQ || peeked == T_NEQ || peeked == T_LARGER || peeked == T_LARGEREQ || peeked == T_SMALLER || peeked == T_SMALLEREQ )
-    {
-        PAR_Match( par, peeked );
-        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), NULL, TOK_GetLine( par->lastMatched ) );        
+        case T_EQ:
+        case T_NEQ:
+        case T_LARGER:
+        case T_LARGEREQ:
+        case T_SMALLER:
+        case T_SMALLEREQ:
+            return 3;
             
-        AST_AppendChildTree( ast, PAR_ExpandExpCmp( par ) );
-    }
-    
-    AST_PrependChildTree( ast, branch );
-    
-    return ast;
-}
-
-Ast * PAR_ExpandExpAnd( Parser * par )
-{
-    Ast * ast = AST_New();
-    Ast * branch;
-    int peeked;
-    
-    branch = PAR_ExpandExpCmp( par );
-    peeked = PAR_Peek( par );
-    
-    if( peeked == T_AND )
-    {
-        PAR_Match( par, peeked );
-        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), NULL, TOK_GetLine( par->lastMatched ) );        
+        case T_PLUS:
+        case T_MINUS:
+            return 4;
+            
+        case T_ASTERISK:
+        case T_SLASH:
+            return 5;
             
-        AST_AppendChildTree( ast, PAR_ExpandExpAnd( par ) );
+        default:
+            return 0;
     }
-    
-    AST_PrependChildTree( ast, branch );
-    
-    return ast;
 }
 
-Ast * PAR_ExpandExpOr( Parser * par )
+// Precedence climbing: operators of the same level are folded in a loop,
+// left associative, and only a tighter operator on the right recurses.
+Ast * PAR_ExpandExpBinary( Parser * par, int minPrecedence )
 {
-    Ast * ast = AST_New();
-    Ast * branch;
-    int peeked;
-    
-    branch = PAR_ExpandExpAnd( par );
-    peeked = PAR_Peek( par );
+    Ast * lhs = PAR_ExpandExpUnary( par );
+    int peeked = PAR_Peek( par );
+    int precedence = PAR_BinaryPrecedence( peeked );
     
-    if( peeked == T_OR )
+    while( precedence && precedence >= minPrecedence )
     {
+        Ast * ast = AST_NewFrom( par->ast );
+        
         PAR_Match( par, peeked );
-        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), NULL, TOK_GetLine( par->lastMatched ) );        
-            
-        AST_AppendChildTree( ast, PAR_ExpandExpOr( par ) );
+        AST_AppendChildNode( ast, AST_TokenTypeToAst( peeked ), NULL, par->lastLine );
+        AST_AppendChildTree( ast, lhs );
+        AST_AppendChildTree( ast, PAR_ExpandExpBinary( par, precedence + 1 ) );
+        
+        lhs = ast;
+        peeked = PAR_Peek( par );
+        precedence = PAR_BinaryPrecedence( peeked );
     }
     
-    AST_PrependChildTree( ast, branch );
-    
-    return ast;
+    return lhs;
 }
 
 Ast * PAR_ExpandExp( Parser * par )
 {
-    return PAR_ExpandExpOr( par );
+    return PAR_ExpandExpBinary( par, 1 );
 }
 
 Ast * PAR_ExpandExps( Parser * par )
 {
     //printf("PAR: Exps\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     int peeked = PAR_Peek( par );
     
-    AST_AppendChildNode( ast, A_ARGS, NULL, TOK_GetLine( par->lastMatched ) );
+    AST_AppendChildNode( ast, A_ARGS, NULL, par->lastLine );
     
     while( peeked != T_CCBRACKET )
     {
@@ -396,9 +367,9 @@ Ast * PAR_ExpandExps( Parser * par )
 Ast * PAR_ExpandVar( Parser * par )
 {
     //printf("PAR: Var\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     
-    AST_AppendChildNode( ast, A_VAR, NULL, TOK_GetLine( par->lastMatched ) );
+    AST_AppendChildNode( ast, A_VAR, NULL, par->lastLine );
         
     while( PAR_Peek( par ) == T_OSBRACKET )
     {
@@ -413,11 +384,11 @@ Ast * PAR_ExpandVar( Parser * par )
 Ast * PAR_ExpandCmdIf( Parser * par )
 {
     //printf("PAR: CmdIf\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     int foundElse = 0;
     
     PAR_Match( par, T_IF );
-    AST_AppendChildNode( ast, A_IF, NULL, TOK_GetLine( par->lastMatched ) );
+    AST_AppendChildNode( ast, A_IF, NULL, par->lastLine );
     
     AST_AppendChildTree( ast, PAR_ExpandExp( par ) );
     PAR_ExpandNewLine( par );
@@ -449,10 +420,10 @@ Ast * PAR_ExpandCmdIf( Parser * par )
 Ast * PAR_ExpandCmdWhile( Parser * par )
 {
     //printf("PAR: CmdWhile\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     
     PAR_Match( par, T_WHILE );
-    AST_AppendChildNode( ast, A_WHILE, NULL, TOK_GetLine( par->lastMatched ) );
+    AST_AppendChildNode( ast, A_WHILE, NULL, par->lastLine );
     
     AST_AppendChildTree( ast, PAR_ExpandExp( par ) );
     PAR_ExpandNewLine( par );
@@ -465,10 +436,10 @@ Ast * PAR_ExpandCmdWhile( Parser * par )
 Ast * PAR_ExpandCmdReturn( Parser * par )
 {
     //printf("PAR: CmdReturn\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     
     PAR_Match( par, T_RETURN );
-    AST_AppendChildNode( ast, A_RETURN, NULL, TOK_GetLine( par->lastMatched ) );    
+    AST_AppendChildNode( ast, A_RETURN, NULL, par->lastLine );    
     
     if( PAR_Peek( par ) != T_NL )
     {
@@ -480,16 +451,15 @@ Ast * PAR_ExpandCmdReturn( Parser * par )
     return ast;
 }
 
-Ast * PAR_ExpandCmdAssign( Parser * par )
+Ast * PAR_ExpandCmdAssign( Parser * par, Ast * id )
 {
     //printf("PAR: CmdAssign\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     Ast * subAst;
-    Token * matchedId = par->lastMatched;
     
-    AST_AppendChildNode( ast, A_ASSIGN, NULL, TOK_GetLine( par->lastMatched ) );    
+    AST_AppendChildNode( ast, A_ASSIGN, NULL, par->lastLine );    
     subAst = PAR_ExpandVar( par );
-    AST_PrependChildNode( subAst, A_ID, TOK_GetText( matchedId ), TOK_GetLine( par->lastMatched ) );    
+    AST_PrependChildTree( subAst, id );    
                
     AST_AppendChildTree( ast, subAst );
     PAR_Match( par, T_EQ );
@@ -501,10 +471,10 @@ Ast * PAR_ExpandCmdAssign( Parser * par )
 Ast * PAR_ExpandCall( Parser * par )
 {
     //printf("PAR: Call\n");
-    Ast * ast = AST_New();    
+    Ast * ast = AST_NewFrom( par->ast );    
     
     PAR_Match( par, T_OCBRACKET );
-    AST_AppendChildNode( ast, A_CALL, NULL, TOK_GetLine( par->lastMatched ) );    
+    AST_AppendChildNode( ast, A_CALL, NULL, par->lastLine );    
     AST_AppendChildTree( ast, PAR_ExpandExps( par ) );
     PAR_Match( par, T_CCBRACKET );
     
@@ -545,26 +515,25 @@ Ast * PAR_ExpandCmd( Parser * par )
 Ast * PAR_ExpandBlock( Parser * par )
 {
     //printf("PAR: Block\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     Ast * subAst;
-    Token * matchedId;    
+    Ast * id = NULL;    
     int foundID = 0;    
     int peeked = PAR_Peek( par );
     
-    AST_AppendChildNode( ast, A_BLOCK, NULL, TOK_GetLine( par->lastMatched ) + 1 );
+    AST_AppendChildNode( ast, A_BLOCK, NULL, par->lastLine + 1 );
     
     //Declvar
     while( peeked == T_ID )
     {
-        PAR_Match( par, T_ID );
-        matchedId = par->lastMatched;
+        id = PAR_MatchId( par );
         
         peeked = PAR_Peek( par );
         
         if( peeked == T_COLON )
         {
             subAst = PAR_ExpandDeclVar( par );
-            AST_PrependChildNode( subAst, A_ID, TOK_GetText( matchedId ), TOK_GetLine( matchedId ) );
+            AST_PrependChildTree( subAst, id );
             AST_AppendChildTree( ast, subAst );
             
             PAR_ExpandNewLine( par );
@@ -584,7 +553,7 @@ Ast * PAR_ExpandBlock( Parser * par )
     
     	if( peeked == T_EQ || peeked == T_OSBRACKET )
     	{
-    	    subAst = PAR_ExpandCmdAssign( par );
+    	    subAst = PAR_ExpandCmdAssign( par, id );
     	    //AST_PrependChildNode( subAst, A_ID, TOK_GetText( matchedId ) );
             AST_AppendChildTree( ast, subAst );
             
@@ -593,11 +562,15 @@ Ast * PAR_ExpandBlock( Parser * par )
     	else if( peeked == T_OCBRACKET )
     	{
     	    subAst = PAR_ExpandCall( par );
-    	    AST_PrependChildNode( subAst, A_ID, TOK_GetText( matchedId ), TOK_GetLine( matchedId ) );
+    	    AST_PrependChildTree( subAst, id );
             AST_AppendChildTree( ast, subAst );
             
     	    PAR_ExpandNewLine( par );
     	}
+    	else
+    	{
+    	    AST_Delete( id );
+    	}
 	}
         
     peeked = PAR_Peek( par );
@@ -606,14 +579,13 @@ Ast * PAR_ExpandBlock( Parser * par )
     {        
 		if( peeked == T_ID )
 	    {
-	    	PAR_Match( par, T_ID );
-	    	matchedId = par->lastMatched;
+	    	id = PAR_MatchId( par );
 	            
 	        peeked = PAR_Peek( par );
 	           
 	        if( peeked == T_EQ || peeked == T_OSBRACKET )
 	        {
-	            subAst = PAR_ExpandCmdAssign( par );
+	            subAst = PAR_ExpandCmdAssign( par, id );
         	    //AST_PrependChildNode( subAst, A_ID, TOK_GetText( matchedId ) );
                 AST_AppendChildTree( ast, subAst );
                 
@@ -622,11 +594,15 @@ Ast * PAR_ExpandBlock( Parser * par )
 	        else if( peeked == T_OCBRACKET )
 	        {
 	            subAst = PAR_ExpandCall( par );
-        	    AST_PrependChildNode( subAst, A_ID, TOK_GetText( matchedId ), TOK_GetLine( matchedId ) );
+        	    AST_PrependChildTree( subAst, id );
                 AST_AppendChildTree( ast, subAst );
                 
         	    PAR_ExpandNewLine( par );
 	        }
+	        else
+	        {
+	            AST_Delete( id );
+	        }
 	    }
 	    else
 	    {
@@ -644,13 +620,12 @@ Ast * PAR_ExpandBlock( Parser * par )
 Ast * PAR_ExpandFunction( Parser * par )
 {
     //printf("PAR: Function\n");
-    Ast * ast = AST_New();    
+    Ast * ast = AST_NewFrom( par->ast );    
     
     PAR_Match( par, T_FUN );
-    AST_AppendChildNode( ast, A_FUNCTION, NULL, TOK_GetLine( par->lastMatched ) );
+    AST_AppendChildNode( ast, A_FUNCTION, NULL, par->lastLine );
     
-    PAR_Match( par, T_ID );
-    AST_AppendChildNode( ast, A_ID, TOK_GetText( par->lastMatched ), TOK_GetLine( par->lastMatched ) );
+    AST_AppendChildTree( ast, PAR_MatchId( par ) );
     
     PAR_Match( par, T_OCBRACKET );
     
@@ -701,18 +676,23 @@ Ast * PAR_ExpandDecl( Parser * par )
     return ast;
 }
 
+// Declarations up to the end of the stream, appended under program
+void PAR_ExpandDecls( Parser * par, Ast * program )
+{
+    while( PAR_Peek( par ) != -1 )
+    {
+        AST_AppendChildTree( program, PAR_ExpandDecl( par ) );
+    }
+}
+
 void PAR_ExpandProgram( Parser * par )
 {
     //printf("PAR: Program\n");
-    Ast * ast = AST_New();
+    Ast * ast = AST_NewFrom( par->ast );
     AST_AppendChildNode( ast, A_PROGRAM, NULL, 0 );
     
     PAR_ExpandNewLine( par );
-    
-    while( PAR_Peek( par ) != -1 )
-    {
-        AST_AppendChildTree( ast, PAR_ExpandDecl( par ) );
-    }
+    PAR_ExpandDecls( par, ast );
     
     AST_AppendChildTree( par->ast, ast );
     fprintf( stdout, "Parsing successful!\n" );   
@@ -725,7 +705,8 @@ Parser * PAR_New()
     Parser * par = ( Parser* )malloc( sizeof( Parser ) );
     par->tokens = NULL;
     par->ast = AST_New();
-    par->lastMatched = NULL;
+    par->lastLine = 0;
+    par->nTokens = 0;
     
     return par;
 }
@@ -734,25 +715,233 @@ void PAR_Delete( Parser * par )
 {
     if( par )
     {
-        LIS_Delete( par->tokens, &TOK_Delete );        
         free( par );      
     }
 }
 
-void PAR_Execute( Parser * par, List * tokens )
+void PAR_Execute( Parser * par, TokenStream * tokens )
 {
     par->tokens = tokens;
     
-    if( LIS_GetSize( par->tokens ) )
+    if( PAR_Peek( par ) != -1 )
         PAR_ExpandProgram( par );
+        
+    par->nTokens = TKS_GetCount( tokens );
+    AST_Flatten( par->ast );
 }
 
-void PAR_DumpTokens( Parser * par )
+/********************************************************************/
+
+// Top level declarations only ever begin with fun or an ID, and each one
+// ends with a newline, so a line starting with fun always starts a new
+// declaration. The source is cut at such lines into segments that are
+// parsed on their own, each into a tree of its own arena.
+
+typedef struct segment Segment;
+
+struct segment
+{
+    const char * start;
+    int size;
+    int line;
+    Ast * decls;        // Under a placeholder root, NULL if the segment failed
+    int nTokens;
+};
+
+typedef struct segmentQueue SegmentQueue;
+
+struct segmentQueue
+{
+    Segment * segments;
+    int nSegments;
+    int next;           // Next segment to be taken by a worker
+};
+
+static void PAR_LexerFailed( Token * tok )
+{
+    ( void )tok;
+    longjmp( *recovery, 1 );
+}
+
+static void PAR_MatchFailed( void * received, int expected )
+{
+    ( void )received;
+    ( void )expected;
+    longjmp( *recovery, 1 );
+}
+
+static void PAR_ParseSegment( Segment * seg )
+{
+    Lexer * lex = LEX_NewFromSpan( seg->start, seg->size, seg->line );
+    TokenStream * tokens = TKS_New( lex, &PAR_LexerFailed );
+    Parser * par = PAR_New();
+    jmp_buf env;
+    
+    TKS_SetMatchError( tokens, &PAR_MatchFailed );
+    par->tokens = tokens;
+    seg->decls = NULL;
+    
+    if( setjmp( env ) == 0 )
+    {
+        Ast * decls = AST_NewFrom( par->ast );
+        
+        recovery = &env;
+        AST_AppendChildNode( decls, A_PROGRAM, NULL, 0 );
+        PAR_ExpandDecls( par, decls );
+        AST_AppendChildTree( par->ast, decls );
+        
+        seg->decls = par->ast;
+        seg->nTokens = TKS_GetCount( tokens );
+    }
+    else
+    {
+        // Wrappers of the productions left open are lost, the nodes go
+        // with the arena
+        AST_Delete( par->ast );
+    }
+    
+    recovery = NULL;
+    
+    PAR_Delete( par );
+    TKS_Delete( tokens );
+    LEX_Delete( lex );
+}
+
+static void * PAR_Worker( void * arg )
+{
+    SegmentQueue * queue = ( SegmentQueue* )arg;
+    int i;
+    
+    while( ( i = __atomic_fetch_add( &queue->next, 1, __ATOMIC_RELAXED ) ) < queue->nSegments )
+        PAR_ParseSegment( &queue->segments[i] );
+        
+    return NULL;
+}
+
+// Cuts the source into segments of at least minSize bytes
+static Segment * PAR_Split( const char * source, int size, int minSize, int * outCount )
+{
+    int maxSegments = 16;
+    int nSegments = 0;
+    Segment * segments = ( Segment* )malloc( maxSegments * sizeof( Segment ) );
+    const char * end = source + size;
+    const char * start = source;
+    const char * curr = source;
+    int startLine = 1;
+    int line = 1;
+    
+    while( start < end )
+    {
+        while( curr < end && curr - start < minSize )
+            curr = LEX_FindFunction( curr, end, &line );
+            
+        if( nSegments == maxSegments )
+        {
+            maxSegments *= 2;
+            segments = ( Segment* )realloc( segments, maxSegments * sizeof( Segment ) );
+        }
+        
+        segments[nSegments].start = start;
+        segments[nSegments].size = curr - start;
+        segments[nSegments].line = startLine;
+        nSegments++;
+        
+        start = curr;
+        startLine = line;
+    }
+    
+    *outCount = nSegments;
+    
+    return segments;
+}
+
+// Same result as PAR_Execute over the whole of lex, with the top level
+// declarations parsed by up to nJobs threads. Past the first segment that
+// fails, the rest of the source is parsed again here, so errors come out
+// exactly as a serial parse gives them.
+void PAR_ExecuteParallel( Parser * par, Lexer * lex, void (*pfuncError)( Token * ), int nJobs )
 {
-    LIS_Dump( par->tokens, &TOK_Dump );
+    int size;
+    const char * source = LEX_GetSource( lex, &size );
+    SegmentQueue queue;
+    pthread_t * threads;
+    Ast * program;
+    int i;
+    
+    queue.segments = PAR_Split( source, size, size / ( nJobs * PAR_SEGMENTS_PER_JOB ) + PAR_MIN_SEGMENT, &queue.nSegments );
+    queue.next = 0;
+    
+    if( queue.nSegments < 2 )
+    {
+        TokenStream * tokens = TKS_New( lex, pfuncError );
+        
+        free( queue.segments );
+        PAR_Execute( par, tokens );
+        TKS_Delete( tokens );
+        
+        return;
+    }
+    
+    if( nJobs > queue.nSegments )
+        nJobs = queue.nSegments;
+        
+    threads = ( pthread_t* )malloc( nJobs * sizeof( pthread_t ) );
+    
+    for( i = 0; i < nJobs; i++ )
+        pthread_create( &threads[i], NULL, &PAR_Worker, &queue );
+        
+    for( i = 0; i < nJobs; i++ )
+        pthread_join( threads[i], NULL );
+        
+    free( threads );
+    
+    program = AST_NewFrom( par->ast );
+    AST_AppendChildNode( program, A_PROGRAM, NULL, 0 );
+    
+    for( i = 0; i < queue.nSegments; i++ )
+    {
+        Segment * seg = &queue.segments[i];
+        
+        if( !seg->decls )
+            break;
+            
+        AST_AppendChildren( program, seg->decls );
+        par->nTokens += seg->nTokens;
+    }
+    
+    if( i < queue.nSegments )
+    {
+        Segment * failed = &queue.segments[i];
+        Lexer * rest = LEX_NewFromSpan( failed->start, source + size - failed->start, failed->line );
+        TokenStream * tokens = TKS_New( rest, pfuncError );
+        
+        par->tokens = tokens;
+        PAR_ExpandDecls( par, program );
+        par->nTokens += TKS_GetCount( tokens );
+        par->tokens = NULL;
+        
+        TKS_Delete( tokens );
+        LEX_Delete( rest );
+        
+        for( i++; i < queue.nSegments; i++ )
+            AST_Delete( queue.segments[i].decls );
+    }
+    
+    free( queue.segments );
+    
+    AST_AppendChildTree( par->ast, program );
+    fprintf( stdout, "Parsing successful!\n" );
+    
+    AST_Flatten( par->ast );
 }
 
 Ast * PAR_GetAst( Parser * par )
 {
     return par->ast;
 }
+
+// Tokens read by the last execution, comments excluded
+int PAR_GetTokenCount( Parser * par )
+{
+    return par->nTokens;
+}
@@ -2,7 +2,7 @@
 #define PARSER_H
 
 #include "token.h"
-#include "list.h"
+#include "stream.h"
 #include "ast.h"
 
 typedef struct parser Parser;
@@ -12,10 +12,12 @@ Parser * PAR_New();
 
 void PAR_Delete( Parser * par );
 
-void PAR_Execute( Parser * par, List * tokens );
+void PAR_Execute( Parser * par, TokenStream * tokens );
 
-void PAR_DumpTokens( Parser * par );
+void PAR_ExecuteParallel( Parser * par, Lexer * lex, void (*pfuncError)( Token * ), int nJobs );
 
 Ast * PAR_GetAst( Parser * par );
 
+int PAR_GetTokenCount( Parser * par );
+
 #endif
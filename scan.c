@@ -0,0 +1,300 @@
+#include <stddef.h>
+#include <pthread.h>
+
+#include "scan.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define SCN_IS_SPACE( c )   ( ( c ) == ' ' || ( c ) == '\t' || ( c ) == '\0' )
+#define SCN_IS_WORD( c )    ( ( unsigned char )( ( ( c ) | 0x20 ) - 'a' ) <= 'z' - 'a' || \
+                              ( unsigned char )( ( c ) - '0' ) <= 9 || ( c ) == '_' )
+
+typedef struct
+{
+    const char * ( *skipSpaces )( const char *, const char * );
+    const char * ( *skipWord )( const char *, const char * );
+    const char * ( *findNewline )( const char *, const char * );
+    const char * ( *findCommentStop )( const char *, const char * );
+} ScanKernels;
+
+// Scalar versions, also used for the tails shorter than a vector
+
+static const char * SCN_SkipSpacesScalar( const char * curr, const char * end )
+{
+    while( curr < end && SCN_IS_SPACE( *curr ) )
+        curr++;
+    return curr;
+}
+
+static const char * SCN_SkipWordScalar( const char * curr, const char * end )
+{
+    while( curr < end && SCN_IS_WORD( *curr ) )
+        curr++;
+    return curr;
+}
+
+static const char * SCN_FindNewlineScalar( const char * curr, const char * end )
+{
+    while( curr < end && *curr != '\n' )
+        curr++;
+    return curr;
+}
+
+static const char * SCN_FindCommentStopScalar( const char * curr, const char * end )
+{
+    while( curr < end && *curr != '\n' && *curr != '*' )
+        curr++;
+    return curr;
+}
+
+static const ScanKernels scalarKernels =
+{
+    SCN_SkipSpacesScalar, SCN_SkipWordScalar, SCN_FindNewlineScalar, SCN_FindCommentStopScalar
+};
+
+#ifdef SCAN_X86
+
+// Each vector loop builds a mask with one bit per byte that ends the run and
+// returns at its lowest set bit. "t <= k" on unsigned bytes is min( t, k ) == t.
+
+#define SSE2_LE( t, k )     _mm_cmpeq_epi8( _mm_min_epu8( t, k ), t )
+#define AVX2_LE( t, k )     _mm256_cmpeq_epi8( _mm256_min_epu8( t, k ), t )
+
+__attribute__(( target( "sse2" ) ))
+static const char * SCN_SkipSpacesSSE2( const char * curr, const char * end )
+{
+    const __m128i space = _mm_set1_epi8( ' ' );
+    const __m128i tab = _mm_set1_epi8( '\t' );
+    const __m128i zero = _mm_setzero_si128();
+
+    while( end - curr >= 16 )
+    {
+        __m128i v = _mm_loadu_si128( ( const __m128i* )curr );
+        __m128i in = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( v, space ), _mm_cmpeq_epi8( v, tab ) ),
+                                   _mm_cmpeq_epi8( v, zero ) );
+        unsigned stop = ~_mm_movemask_epi8( in ) & 0xFFFF;
+
+        if( stop )
+            return curr + __builtin_ctz( stop );
+
+        curr += 16;
+    }
+
+    return SCN_SkipSpacesScalar( curr, end );
+}
+
+__attribute__(( target( "sse2" ) ))
+static const char * SCN_SkipWordSSE2( const char * curr, const char * end )
+{
+    const __m128i lowerBit = _mm_set1_epi8( 0x20 );
+    const __m128i a = _mm_set1_epi8( 'a' );
+    const __m128i letters = _mm_set1_epi8( 'z' - 'a' );
+    const __m128i zero = _mm_set1_epi8( '0' );
+    const __m128i digits = _mm_set1_epi8( 9 );
+    const __m128i underscore = _mm_set1_epi8( '_' );
+
+    while( end - curr >= 16 )
+    {
+        __m128i v = _mm_loadu_si128( ( const __m128i* )curr );
+        __m128i letter = _mm_sub_epi8( _mm_or_si128( v, lowerBit ), a );
+        __m128i digit = _mm_sub_epi8( v, zero );
+        __m128i in = _mm_or_si128( _mm_or_si128( SSE2_LE( letter, letters ), SSE2_LE( digit, digits ) ),
+                                   _mm_cmpeq_epi8( v, underscore ) );
+        unsigned stop = ~_mm_movemask_epi8( in ) & 0xFFFF;
+
+        if( stop )
+            return curr + __builtin_ctz( stop );
+
+        curr += 16;
+    }
+
+    return SCN_SkipWordScalar( curr, end );
+}
+
+__attribute__(( target( "sse2" ) ))
+static const char * SCN_FindNewlineSSE2( const char * curr, const char * end )
+{
+    const __m128i newline = _mm_set1_epi8( '\n' );
+
+    while( end - curr >= 16 )
+    {
+        __m128i v = _mm_loadu_si128( ( const __m128i* )curr );
+        unsigned stop = _mm_movemask_epi8( _mm_cmpeq_epi8( v, newline ) );
+
+        if( stop )
+            return curr + __builtin_ctz( stop );
+
+        curr += 16;
+    }
+
+    return SCN_FindNewlineScalar( curr, end );
+}
+
+__attribute__(( target( "sse2" ) ))
+static const char * SCN_FindCommentStopSSE2( const char * curr, const char * end )
+{
+    const __m128i newline = _mm_set1_epi8( '\n' );
+    const __m128i star = _mm_set1_epi8( '*' );
+
+    while( end - curr >= 16 )
+    {
+        __m128i v = _mm_loadu_si128( ( const __m128i* )curr );
+        unsigned stop = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( v, newline ), _mm_cmpeq_epi8( v, star ) ) );
+
+        if( stop )
+            return curr + __builtin_ctz( stop );
+
+        curr += 16;
+    }
+
+    return SCN_FindCommentStopScalar( curr, end );
+}
+
+__attribute__(( target( "avx2" ) ))
+static const char * SCN_SkipSpacesAVX2( const char * curr, const char * end )
+{
+    const __m256i space = _mm256_set1_epi8( ' ' );
+    const __m256i tab = _mm256_set1_epi8( '\t' );
+    const __m256i zero = _mm256_setzero_si256();
+
+    while( end - curr >= 32 )
+    {
+        __m256i v = _mm256_loadu_si256( ( const __m256i* )curr );
+        __m256i in = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( v, space ), _mm256_cmpeq_epi8( v, tab ) ),
+                                      _mm256_cmpeq_epi8( v, zero ) );
+        unsigned stop = ~( unsigned )_mm256_movemask_epi8( in );
+
+        if( stop )
+            return curr + __builtin_ctz( stop );
+
+        curr += 32;
+    }
+
+    return SCN_SkipSpacesSSE2( curr, end );
+}
+
+__attribute__(( target( "avx2" ) ))
+static const char * SCN_SkipWordAVX2( const char * curr, const char * end )
+{
+    const __m256i lowerBit = _mm256_set1_epi8( 0x20 );
+    const __m256i a = _mm256_set1_epi8( 'a' );
+    const __m256i letters = _mm256_set1_epi8( 'z' - 'a' );
+    const __m256i zero = _mm256_set1_epi8( '0' );
+    const __m256i digits = _mm256_set1_epi8( 9 );
+    const __m256i underscore = _mm256_set1_epi8( '_' );
+
+    while( end - curr >= 32 )
+    {
+        __m256i v = _mm256_loadu_si256( ( const __m256i* )curr );
+        __m256i letter = _mm256_sub_epi8( _mm256_or_si256( v, lowerBit ), a );
+        __m256i digit = _mm256_sub_epi8( v, zero );
+        __m256i in = _mm256_or_si256( _mm256_or_si256( AVX2_LE( letter, letters ), AVX2_LE( digit, digits ) ),
+                                      _mm256_cmpeq_epi8( v, underscore ) );
+        unsigned stop = ~( unsigned )_mm256_movemask_epi8( in );
+
+        if( stop )
+            return curr + __builtin_ctz( stop );
+
+        curr += 32;
+    }
+
+    return SCN_SkipWordSSE2( curr, end );
+}
+
+__attribute__(( target( "avx2" ) ))
+static const char * SCN_FindNewlineAVX2( const char * curr, const char * end )
+{
+    const __m256i newline = _mm256_set1_epi8( '\n' );
+
+    while( end - curr >= 32 )
+    {
+        __m256i v = _mm256_loadu_si256( ( const __m256i* )curr );
+        unsigned stop = _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, newline ) );
+
+        if( stop )
+            return curr + __builtin_ctz( stop );
+
+        curr += 32;
+    }
+
+    return SCN_FindNewlineSSE2( curr, end );
+}
+
+__attribute__(( target( "avx2" ) ))
+static const char * SCN_FindCommentStopAVX2( const char * curr, const char * end )
+{
+    const __m256i newline = _mm256_set1_epi8( '\n' );
+    const __m256i star = _mm256_set1_epi8( '*' );
+
+    while( end - curr >= 32 )
+    {
+        __m256i v = _mm256_loadu_si256( ( const __m256i* )curr );
+        unsigned stop = _mm256_movemask_epi8( _mm256_or_si256( _mm256_cmpeq_epi8( v, newline ),
+                                                               _mm256_cmpeq_epi8( v, star ) ) );
+
+        if( stop )
+            return curr + __builtin_ctz( stop );
+
+        curr += 32;
+    }
+
+    return SCN_FindCommentStopSSE2( curr, end );
+}
+
+static const ScanKernels sse2Kernels =
+{
+    SCN_SkipSpacesSSE2, SCN_SkipWordSSE2, SCN_FindNewlineSSE2, SCN_FindCommentStopSSE2
+};
+
+static const ScanKernels avx2Kernels =
+{
+    SCN_SkipSpacesAVX2, SCN_SkipWordAVX2, SCN_FindNewlineAVX2, SCN_FindCommentStopAVX2
+};
+
+#endif
+
+static const ScanKernels * kernels = &scalarKernels;
+static pthread_once_t selectOnce = PTHREAD_ONCE_INIT;
+
+// Picks the widest kernels the CPU runs, once for all the lexer threads
+static void SCN_Select()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if( __builtin_cpu_supports( "avx2" ) )
+        kernels = &avx2Kernels;
+    else if( __builtin_cpu_supports( "sse2" ) )
+        kernels = &sse2Kernels;
+#endif
+}
+
+static const ScanKernels * SCN_Kernels()
+{
+    pthread_once( &selectOnce, SCN_Select );
+
+    return kernels;
+}
+
+const char * SCN_SkipSpaces( const char * curr, const char * end )
+{
+    return SCN_Kernels()->skipSpaces( curr, end );
+}
+
+const char * SCN_SkipWord( const char * curr, const char * end )
+{
+    return SCN_Kernels()->skipWord( curr, end );
+}
+
+const char * SCN_FindNewline( const char * curr, const char * end )
+{
+    return SCN_Kernels()->findNewline( curr, end );
+}
+
+const char * SCN_FindCommentStop( const char * curr, const char * end )
+{
+    return SCN_Kernels()->findCommentStop( curr, end );
+}
@@ -0,0 +1,21 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+// Byte scanning kernels for the lexer hot loops. Each one returns the first
+// position in [curr, end) that stops the run, or end if there is none.
+// SSE2 or AVX2 versions are picked on first use when the CPU has them, once
+// for all threads.
+
+// Skips ' ', '\t' and '\0'
+const char * SCN_SkipSpaces( const char * curr, const char * end );
+
+// Skips identifier chars: letters, digits and '_'
+const char * SCN_SkipWord( const char * curr, const char * end );
+
+// Finds the next '\n'
+const char * SCN_FindNewline( const char * curr, const char * end );
+
+// Finds the next '*' or '\n', the only bytes that matter inside a block comment
+const char * SCN_FindCommentStop( const char * curr, const char * end );
+
+#endif
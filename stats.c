@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+// mallinfo2 came with glibc 2.33
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ( 2, 33 )
+#define STS_MALLINFO2
+#include <malloc.h>
+#endif
+#endif
+
+#include "stats.h"
+
+#define MAX_PHASES  16
+#define MAX_ITEMS   4
+
+typedef struct phase Phase;
+
+struct phase
+{
+    const char * name;
+    double wall;
+    double cpu;
+    long rss;
+    long heap;
+    unsigned long allocs;
+    
+    // Values when the phase was last begun
+    double wallStart;
+    double cpuStart;
+    long rssStart;
+    long heapStart;
+    unsigned long allocsStart;
+    
+    const char * items[MAX_ITEMS];
+    long counts[MAX_ITEMS];
+    int nItems;
+};
+
+static int enabled = 0;
+static unsigned long nAllocs = 0;    // Counted by STS_CountAlloc
+static Phase phases[MAX_PHASES];
+static int nPhases = 0;
+
+static double STS_Clock( clockid_t id )
+{
+    struct timespec ts;
+    clock_gettime( id, &ts );
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Peak resident set size so far, in KiB
+static long STS_PeakRss()
+{
+    struct rusage ru;
+    getrusage( RUSAGE_SELF, &ru );
+    return ru.ru_maxrss;
+}
+
+// Bytes of the heap in use, in KiB. Only read while stats are enabled, as
+// the allocator is not otherwise watched.
+static long STS_Heap()
+{
+#ifdef STS_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+    return ( long )( ( mi.uordblks + mi.hblkhd ) / 1024 );
+#else
+    return 0;
+#endif
+}
+
+static Phase * STS_Find( const char * name )
+{
+    int i;
+    
+    for( i = 0; i < nPhases; i++ )
+    {
+        if( strcmp( phases[i].name, name ) == 0 )
+            return &phases[i];
+    }
+    
+    if( nPhases == MAX_PHASES )
+    {
+        fprintf( stderr, "!Stats Error: too many phases.\n" );
+        exit( EXIT_FAILURE );
+    }
+    
+    Phase * p = &phases[nPhases++];
+    memset( p, 0, sizeof( Phase ) );
+    p->name = name;
+    
+    return p;
+}
+
+void STS_Enable()
+{
+    enabled = 1;
+}
+
+int STS_IsEnabled()
+{
+    return enabled;
+}
+
+// Allocations are counted where the compiler's own constructors and
+// arenas allocate, not for every malloc of the process
+void STS_CountAlloc()
+{
+    if( enabled )
+        __atomic_fetch_add( &nAllocs, 1, __ATOMIC_RELAXED );
+}
+
+void STS_Begin( const char * phase )
+{
+    if( !enabled )
+        return;
+        
+    Phase * p = STS_Find( phase );
+    p->rssStart = STS_PeakRss();
+    p->heapStart = STS_Heap();
+    p->allocsStart = __atomic_load_n( &nAllocs, __ATOMIC_RELAXED );
+    p->cpuStart = STS_Clock( CLOCK_PROCESS_CPUTIME_ID );
+    p->wallStart = STS_Clock( CLOCK_MONOTONIC );
+}
+
+void STS_End( const char * phase )
+{
+    if( !enabled )
+        return;
+        
+    double wall = STS_Clock( CLOCK_MONOTONIC );
+    double cpu = STS_Clock( CLOCK_PROCESS_CPUTIME_ID );
+    Phase * p = STS_Find( phase );
+    
+    p->wall += wall - p->wallStart;
+    p->cpu += cpu - p->cpuStart;
+    p->heap += STS_Heap() - p->heapStart;
+    p->allocs += __atomic_load_n( &nAllocs, __ATOMIC_RELAXED ) - p->allocsStart;
+    p->rss += STS_PeakRss() - p->rssStart;
+}
+
+// Adds to the count of an item produced by the phase
+void STS_Count( const char * phase, const char * item, long count )
+{
+    if( !enabled )
+        return;
+        
+    Phase * p = STS_Find( phase );
+    int i;
+    
+    for( i = 0; i < p->nItems; i++ )
+    {
+        if( strcmp( p->items[i], item ) == 0 )
+        {
+            p->counts[i] += count;
+            return;
+        }
+    }
+    
+    if( p->nItems < MAX_ITEMS )
+    {
+        p->items[p->nItems] = item;
+        p->counts[p->nItems] = count;
+        p->nItems++;
+    }
+}
+
+void STS_Report()
+{
+    if( !enabled )
+        return;
+        
+    int i, j;
+    
+    fprintf( stderr, "%-12s %10s %10s %10s %10s %10s  %s\n", "phase", "wall ms", "cpu ms", "rss KiB", "heap KiB", "allocs", "items" );
+    
+    for( i = 0; i < nPhases; i++ )
+    {
+        Phase * p = &phases[i];
+        
+        fprintf( stderr, "%-12s %10.3f %10.3f %10ld %10ld %10lu ", p->name, p->wall, p->cpu, p->rss, p->heap, p->allocs );
+        
+        for( j = 0; j < p->nItems; j++ )
+            fprintf( stderr, " %ld %s", p->counts[j], p->items[j] );
+            
+        fprintf( stderr, "\n" );
+    }
+    
+    fprintf( stderr, "peak rss %ld KiB, heap in use %ld KiB, %lu allocations\n", STS_PeakRss(), STS_Heap(), nAllocs );
+}
@@ -0,0 +1,23 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Per-phase cost report, printed on stderr by --stats. Phases are named,
+// and a phase begun and ended several times accumulates. Each reports its
+// wall and CPU time, how much it grew the peak RSS and the heap in use,
+// and the allocations counted by STS_CountAlloc.
+
+void STS_Enable();
+
+int STS_IsEnabled();
+
+void STS_Begin( const char * phase );
+
+void STS_End( const char * phase );
+
+void STS_Count( const char * phase, const char * item, long count );
+
+void STS_CountAlloc();
+
+void STS_Report();
+
+#endif
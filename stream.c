@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "stream.h"
+
+
+TokenStream * TKS_New( Lexer * lex, void (*pfuncError)( Token * ) )
+{
+    TokenStream * tks = ( TokenStream* )malloc( sizeof( TokenStream ) );
+    tks->lex = lex;
+    tks->pfuncError = pfuncError;
+    tks->pfuncMatchError = &TOK_MatchError;
+    tks->head = 0;
+    tks->count = 0;
+    tks->eof = 0;
+    tks->matched = NULL;
+    tks->nTokens = 0;
+    
+    return tks;
+}
+
+void TKS_Delete( TokenStream * tks )
+{
+    if( tks )
+    {
+        while( tks->count )
+        {
+            TOK_Delete( tks->ring[tks->head] );
+            tks->head = ( tks->head + 1 ) & TKS_MASK;
+            tks->count--;
+        }
+        
+        if( tks->matched )
+            TOK_Delete( tks->matched );
+            
+        free( tks );
+    }
+}
+
+void TKS_SetMatchError( TokenStream * tks, void (*pfuncMatchError)( void *, int ) )
+{
+    tks->pfuncMatchError = pfuncMatchError;
+}
+
+// Reads from the lexer until k tokens are buffered or the input is over.
+// Comments never enter the ring and lexing errors go to pfuncError as soon
+// as they are read. Returns the number of buffered tokens.
+int TKS_Fill( TokenStream * tks, int k )
+{
+    assert( k <= TKS_CAPACITY );
+    
+    while( tks->count < k && !tks->eof )
+    {
+        Token * tok = LEX_NextToken( tks->lex );
+        int type;
+        int slot;
+        
+        if( !tok )
+        {
+            tks->eof = 1;
+            break;
+        }
+        
+        type = TOK_GetType( tok );
+        
+        if( type == T_COMMENT )
+        {
+            TOK_Delete( tok );
+            continue;
+        }
+        
+        if( type == T_ERROR )
+        {
+            ( *tks->pfuncError )( tok );
+            TOK_Delete( tok );
+            continue;
+        }
+        
+        slot = ( tks->head + tks->count ) & TKS_MASK;
+        tks->ring[slot] = tok;
+        tks->types[slot] = type;
+        tks->count++;
+        tks->nTokens++;
+    }
+    
+    return tks->count;
+}
+
+// k-th token ahead, 0 being the next one. NULL at the end of the input.
+Token * TKS_PeekToken( TokenStream * tks, int k )
+{
+    if( k >= tks->count && TKS_Fill( tks, k + 1 ) <= k )
+        return NULL;
+        
+    return tks->ring[( tks->head + k ) & TKS_MASK];
+}
+
+// Tokens read so far, comments excluded
+int TKS_GetCount( TokenStream * tks )
+{
+    return tks->nTokens;
+}
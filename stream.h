@@ -0,0 +1,70 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "lexer.h"
+
+// Lookahead window of the stream, must be a power of two
+#define TKS_CAPACITY    8
+#define TKS_MASK        ( TKS_CAPACITY - 1 )
+
+typedef struct tokenStream TokenStream;
+
+// Ring buffer of tokens pulled on demand from the lexer. The struct is
+// public only so that peek and match inline into the parser, the fields
+// are not meant to be touched anywhere else. Token types are kept apart
+// from the tokens so that peeks never leave this struct.
+struct tokenStream
+{
+    int types[TKS_CAPACITY];
+    Token * ring[TKS_CAPACITY];
+    int head;
+    int count;
+    Token * matched;
+    Lexer * lex;
+    void (*pfuncError)( Token * );
+    void (*pfuncMatchError)( void *, int );
+    int eof;
+    int nTokens;
+};
+
+
+TokenStream * TKS_New( Lexer * lex, void (*pfuncError)( Token * ) );
+
+void TKS_Delete( TokenStream * tks );
+
+// Replaces TOK_MatchError, which TKS_Match calls on an unexpected token
+void TKS_SetMatchError( TokenStream * tks, void (*pfuncMatchError)( void *, int ) );
+
+int TKS_Fill( TokenStream * tks, int k );
+
+Token * TKS_PeekToken( TokenStream * tks, int k );
+
+int TKS_GetCount( TokenStream * tks );
+
+// Type of the k-th token ahead, 0 being the next one. -1 at the end of the input.
+static inline int TKS_Peek( TokenStream * tks, int k )
+{
+    if( k >= tks->count && TKS_Fill( tks, k + 1 ) <= k )
+        return -1;
+        
+    return tks->types[( tks->head + k ) & TKS_MASK];
+}
+
+// Consumes the next token, which must be of the given type. The returned
+// token stays valid until the next match.
+static inline Token * TKS_Match( TokenStream * tks, int type )
+{
+    if( TKS_Peek( tks, 0 ) != type )
+        ( *tks->pfuncMatchError )( TKS_PeekToken( tks, 0 ), type );
+        
+    if( tks->matched )
+        TOK_Delete( tks->matched );
+        
+    tks->matched = tks->ring[tks->head];
+    tks->head = ( tks->head + 1 ) & TKS_MASK;
+    tks->count--;
+    
+    return tks->matched;
+}
+
+#endif
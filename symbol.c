@@ -1,89 +1,284 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "symbol.h"
+#include "arena.h"
+#include "stats.h"
 
-#define MAX_PARAMS 16
+#define SYM_INITIAL_SIGNATURES  256
+
+// A parameter is one int: the type in the low 3 bits, the pointer depth
+// above them
+#define SYM_PACK( type, ptrType )   ( ( ( ptrType ) << 3 ) | ( type ) )
+#define SYM_PACKED_TYPE( param )    ( ( param ) & 7 )
+#define SYM_PACKED_PTR( param )     ( ( param ) >> 3 )
+
+// Plain types up to this pointer depth are built once at first use, the
+// deeper ones on demand
+#define SYM_SHALLOW_PTRS    8
 
 struct symbol
 {    
 	int type;
 	int ptrType;
-	int * paramsType;
-	int * paramsPtrType;
+	const int * params;     // Packed, interned by SYM_EndParams
 	int nParams;
-	int scopeId;
 };
 
+typedef struct signature Signature;
+
+struct signature
+{
+    unsigned hash;
+    int nParams;
+    const int * params;
+};
+
+// Interned signatures, open addressing with linear probing, never more
+// than half full. Type checking threads intern concurrently.
+static Signature * signatures = NULL;
+static unsigned nSignatureSlots = 0;
+static unsigned nSignatures = 0;
+static Arena * signatureStore = NULL;
+static pthread_mutex_t signatureLock = PTHREAD_MUTEX_INITIALIZER;
+
 Symbol * SYM_New( int type, int ptrType )
 {
     Symbol * s = ( Symbol* )malloc( sizeof( Symbol ) );    
+    STS_CountAlloc();
     
     s->type = type;
     s->ptrType = ptrType;
-    s->paramsType = NULL;
-    s->paramsPtrType = NULL;
+    s->params = NULL;
     s->nParams = 0;
-    s->scopeId = 0;
     
     return s;
 }
 
-void SYM_Delete( Symbol * sym )
+static Symbol shallow[S_STRING + 1][SYM_SHALLOW_PTRS];
+static pthread_once_t shallowOnce = PTHREAD_ONCE_INIT;
+
+// Rows of S_STRING + 1 types for each depth past the shallow ones
+static Symbol ** deep = NULL;
+static int nDeep = 0;
+static pthread_mutex_t deepLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void SYM_InitShallow()
 {
-    if( !sym )
-        return;
+    int type;
+    int ptrType;
+    
+    for( type = 0; type <= S_STRING; type++ )
+    {
+        for( ptrType = 0; ptrType < SYM_SHALLOW_PTRS; ptrType++ )
+        {
+            shallow[type][ptrType].type = type;
+            shallow[type][ptrType].ptrType = ptrType;
+        }
+    }
+}
+
+// The one Symbol of a plain type, not a function. Equal types give the same
+// pointer. Canonical symbols are shared by every annotation of their type,
+// so they must never be given params or deleted.
+Symbol * SYM_Type( int type, int ptrType )
+{
+    Symbol * sym;
+    
+    pthread_once( &shallowOnce, &SYM_InitShallow );
+    
+    if( ptrType < SYM_SHALLOW_PTRS )
+        return &shallow[type][ptrType];
         
-    if( sym->nParams )
+    int index = ( ptrType - SYM_SHALLOW_PTRS ) * ( S_STRING + 1 ) + type;
+    
+    pthread_mutex_lock( &deepLock );
+    
+    if( index >= nDeep )
     {
-        free( sym->paramsType );
-        free( sym->paramsPtrType );
+        int newSize = ( ptrType - SYM_SHALLOW_PTRS + 1 ) * ( S_STRING + 1 );
+        
+        deep = ( Symbol** )realloc( deep, newSize * sizeof( Symbol* ) );
+        memset( deep + nDeep, 0, ( newSize - nDeep ) * sizeof( Symbol* ) );
+        nDeep = newSize;
     }
     
+    if( !deep[index] )
+        deep[index] = SYM_New( type, ptrType );
+        
+    sym = deep[index];
+    
+    pthread_mutex_unlock( &deepLock );
+    
+    return sym;
+}
+
+// Params are interned, so only the symbol itself is freed
+void SYM_Delete( Symbol * sym )
+{
     free( sym );    
 }
 
+// Adds a parameter to the signature being built, see SYM_EndParams
 void SYM_PushParam( Symbol * sym, int type, int ptrType )
 {
-    if( !sym->paramsType )
+    int * params = ( int* )sym->params;
+    
+    // The builder array doubles each time its size reaches a power of two
+    if( ( sym->nParams & ( sym->nParams - 1 ) ) == 0 )
+        params = ( int* )realloc( params, ( sym->nParams ? 2 * sym->nParams : 4 ) * sizeof( int ) );
+        
+    params[sym->nParams++] = SYM_PACK( type, ptrType );
+    sym->params = params;
+}
+
+static unsigned SYM_HashParams( const int * params, int nParams )
+{
+    // FNV-1a over the packed params
+    unsigned hash = 2166136261u;
+    int i;
+    
+    for( i = 0; i < nParams; i++ )
+    {
+        hash ^= ( unsigned )params[i];
+        hash *= 16777619u;
+    }
+    
+    return hash;
+}
+
+static void SYM_GrowSignatures()
+{
+    Signature * old = signatures;
+    unsigned oldSize = nSignatureSlots;
+    unsigned i;
+    
+    nSignatureSlots = oldSize ? oldSize * 2 : SYM_INITIAL_SIGNATURES;
+    signatures = ( Signature* )calloc( nSignatureSlots, sizeof( Signature ) );
+    
+    for( i = 0; i < oldSize; i++ )
+    {
+        if( old[i].params )
+        {
+            unsigned j = old[i].hash & ( nSignatureSlots - 1 );
+            
+            while( signatures[j].params )
+                j = ( j + 1 ) & ( nSignatureSlots - 1 );
+                
+            signatures[j] = old[i];
+        }
+    }
+    
+    free( old );
+}
+
+static const int * SYM_InternParams( const int * params, int nParams )
+{
+    unsigned hash = SYM_HashParams( params, nParams );
+    const int * interned;
+    unsigned i;
+    
+    pthread_mutex_lock( &signatureLock );
+    
+    if( 2 * ( nSignatures + 1 ) > nSignatureSlots )
+        SYM_GrowSignatures();
+        
+    if( !signatureStore )
+        signatureStore = ARN_New();
+        
+    i = hash & ( nSignatureSlots - 1 );
+    
+    while( signatures[i].params )
     {
-        sym->paramsType = ( int* )malloc( MAX_PARAMS * sizeof( int ) );
-        sym->paramsPtrType = ( int* )malloc( MAX_PARAMS * sizeof( int ) );
-    }   
+        if( signatures[i].hash == hash && signatures[i].nParams == nParams && 
+            memcmp( signatures[i].params, params, nParams * sizeof( int ) ) == 0 )
+            break;
+            
+        i = ( i + 1 ) & ( nSignatureSlots - 1 );
+    }
+    
+    if( !signatures[i].params )
+    {
+        int * copy = ( int* )ARN_Alloc( signatureStore, nParams * sizeof( int ) );
+        
+        memcpy( copy, params, nParams * sizeof( int ) );
+        signatures[i].hash = hash;
+        signatures[i].nParams = nParams;
+        signatures[i].params = copy;
+        nSignatures++;
+    }
+    
+    interned = signatures[i].params;
+    
+    pthread_mutex_unlock( &signatureLock );
     
-    sym->paramsType[sym->nParams] = type;
-    sym->paramsPtrType[sym->nParams] = ptrType;
-    sym->nParams++;
+    return interned;
 }
 
+// Swaps the params pushed so far for the interned signature. Equal
+// signatures then share one exact-sized array and compare by address.
+void SYM_EndParams( Symbol * sym )
+{
+    int * built = ( int* )sym->params;
+    
+    if( !sym->nParams )
+        return;
+        
+    sym->params = SYM_InternParams( built, sym->nParams );
+    free( built );
+}
+
+// Whether arguments of sym2 can be passed to parameters of sym1: same
+// count and pointer depths, types equal or char and int
 int SYM_CompareParams( Symbol * sym1, Symbol * sym2 )
 {
     if( sym1->nParams != sym2->nParams )
         return 0;
         
-    if( sym1->nParams == 0 && sym2->nParams == 0 )
+    if( sym1->params == sym2->params )
         return 1;
             
     int i;
     
     for( i = 0; i < sym1->nParams; i++ )
     {
-        if( sym1->paramsPtrType[i] != sym2->paramsPtrType[i] )
+        int param1 = sym1->params[i];
+        int param2 = sym2->params[i];
+        
+        if( param1 == param2 )
+            continue;
+            
+        if( SYM_PACKED_PTR( param1 ) != SYM_PACKED_PTR( param2 ) )
             return 0;
             
-        if( sym1->paramsType[i] != sym2->paramsType[i] )
-        {
-            if( ( sym1->paramsType[i] == S_CHAR && sym2->paramsType[i] == S_INT ) || ( sym2->paramsType[i] == S_CHAR && sym1->paramsType[i] == S_INT ) )
-                return 1;
-                
+        if( !( ( SYM_PACKED_TYPE( param1 ) == S_CHAR && SYM_PACKED_TYPE( param2 ) == S_INT ) || 
+               ( SYM_PACKED_TYPE( param2 ) == S_CHAR && SYM_PACKED_TYPE( param1 ) == S_INT ) ) )
             return 0;
-        }            
     }
     
     return 1;
 }
 
+// Whether a value of one type can stand for the other: the same type and
+// pointer depth, or char and int when not pointers
+int SYM_Matches( Symbol * sym1, Symbol * sym2 )
+{
+    if( sym1 == sym2 )
+        return 1;
+        
+    if( sym1->ptrType != sym2->ptrType )
+        return 0;
+        
+    if( sym1->type == sym2->type )
+        return 1;
+        
+    return sym1->ptrType == 0 && 
+           ( sym1->type == S_CHAR || sym1->type == S_INT ) && 
+           ( sym2->type == S_CHAR || sym2->type == S_INT );
+}
+
 int SYM_StringToType( char * str )
 {
     if( !str )
@@ -110,7 +305,7 @@ char * SYM_SymbolToString( Symbol * sym )
     {
         if( sym->nParams )
         {
-            char params[3];
+            char params[12];
             sprintf( params, "%d", sym->nParams );
             strcat( str, "function(" );
             strcat( str, params );
@@ -119,7 +314,7 @@ char * SYM_SymbolToString( Symbol * sym )
         
         if( sym->ptrType )
         {
-            char ptrType[4];
+            char ptrType[12];
             
             sprintf( ptrType, "%d", sym->ptrType );
             strcat( str, ptrType );
@@ -163,12 +358,13 @@ int SYM_GetPtrType( Symbol * sym )
     return sym->ptrType;
 }
 
-int SYM_GetScopeId( Symbol * sym )
+int SYM_GetParamCount( Symbol * sym )
 {
-    return sym->scopeId;
+    return sym->nParams;
 }
 
-void SYM_SetScopeId( Symbol * sym, int id )
+void SYM_GetParam( Symbol * sym, int index, int * type, int * ptrType )
 {
-    sym->scopeId = id;
+    *type = SYM_PACKED_TYPE( sym->params[index] );
+    *ptrType = SYM_PACKED_PTR( sym->params[index] );
 }
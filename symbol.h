@@ -13,12 +13,18 @@ typedef struct symbol Symbol;
 
 Symbol * SYM_New( int type, int ptrType );
 
+Symbol * SYM_Type( int type, int ptrType );
+
 void SYM_Delete( Symbol * sym );
 
 void SYM_PushParam( Symbol * sym, int type, int ptrType );
 
+void SYM_EndParams( Symbol * sym );
+
 int SYM_CompareParams( Symbol * sym1, Symbol * sym2 );
 
+int SYM_Matches( Symbol * sym1, Symbol * sym2 );
+
 int SYM_StringToType( char * str );
 
 char * SYM_SymbolToString( Symbol * sym );
@@ -27,8 +33,8 @@ int SYM_GetType( Symbol * sym );
 
 int SYM_GetPtrType( Symbol * sym );
 
-int SYM_GetScopeId( Symbol * sym );
+int SYM_GetParamCount( Symbol * sym );
 
-void SYM_SetScopeId( Symbol * sym, int id );
+void SYM_GetParam( Symbol * sym, int index, int * type, int * ptrType );
 
 #endif
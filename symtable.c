@@ -1,40 +1,76 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <pthread.h>
 
 #include "symtable.h"
 #include "symbol.h"
-#include "uthash.h"
+#include "cache.h"
+#include "stats.h"
 
-#define MAX_SCOPES 4
+#define SYT_INITIAL_SLOTS       256
+#define SYT_INITIAL_BINDINGS    64
+#define SYT_INITIAL_SCOPES      16
 
 #define ERROR_UNDECLARED    0
 #define ERROR_REDEFINED     1
 #define ERROR_UNKNOWN       2
 
+// Set while a function is checked on a worker thread. Errors are then kept
+// in failure and jump back to the worker instead of exiting.
+static __thread jmp_buf * recovery = NULL;
+static __thread char * failure = NULL;
+
+static void fail( const char * format, ... )
+{
+    va_list args;
+    
+    if( recovery )
+    {
+        int length;
+        
+        va_start( args, format );
+        length = vsnprintf( NULL, 0, format, args );
+        va_end( args );
+        
+        failure = ( char* )malloc( length + 1 );
+        
+        va_start( args, format );
+        vsnprintf( failure, length + 1, format, args );
+        va_end( args );
+        
+        longjmp( *recovery, 1 );
+    }
+    
+    va_start( args, format );
+    vfprintf( stderr, format, args );
+    va_end( args );
+    
+    exit( EXIT_FAILURE );
+}
+
 static void errorSymbol( int error, char * name, int line )
 {
     switch( error )
     {
         case ERROR_UNDECLARED:
-            fprintf( stderr, "!Symbol Error [line %d]: Undeclared identifier \'%s\'.\n", line, name );
+            fail( "!Symbol Error [line %d]: Undeclared identifier \'%s\'.\n", line, name );
             break;
             
         case ERROR_REDEFINED:
-            fprintf( stderr, "!Symbol Error [line %d]: Redefinition of identifier \'%s\'.\n", line, name );
+            fail( "!Symbol Error [line %d]: Redefinition of identifier \'%s\'.\n", line, name );
             break;
             
         case ERROR_UNKNOWN:
-            fprintf( stderr, "!Symbol Error: Internal error.\n" );
+            fail( "!Symbol Error: Internal error.\n" );
             break;
             
         default:
+            fail( "" );
             break;
     }
-    
-    free( name );
-    
-    exit( EXIT_FAILURE );
 }
 
 static void errorTyping( int assert, const char * error, int line )
@@ -42,171 +78,235 @@ static void errorTyping( int assert, const char * error, int line )
     if( assert )
         return;
         
-    fprintf( stderr, "!Typing Error [line %d]: %s\n", line, error );
-    
-    exit( EXIT_FAILURE );
+    fail( "!Typing Error [line %d]: %s\n", line, error );
 }
 
-static int scopeIdGen = 1;
+typedef struct binding Binding;
 
-typedef struct hash Hash;
-
-struct hash
+// One declaration of a name. Bindings are stacked in the order they are
+// declared, so closing a scope pops the ones above its first binding.
+struct binding
 {
-    char * id;
+    char * name;        // Interned, so the table is keyed by address
 	Symbol * symbol;
-	int isGlobal;
-	UT_hash_handle hh;
+	int scopeId;
+	int shadowed;       // Binding of the same name this one hides, -1 if none
+};
+
+typedef struct slot Slot;
+
+// Open addressing with linear probing, never more than half full. Slots
+// of names without a live binding are only dropped when the table grows.
+struct slot
+{
+    char * name;
+    int binding;        // Innermost binding of name, -1 if none
 };
 
 typedef struct scope Scope;
 
+// Only scopes that declare something get one, see SYT_OpenScope
 struct scope
 {
-	Scope * parent;
-	Scope ** scopes;	
+	int id;
+	int firstBinding;
+};
+
+void SYT_ProcessNode( SymTable * syt, AstNode ast );
+void SYT_VisitExpression( SymTable * syt, AstNode ast );
+
+// Every name in sight maps to its innermost binding through one table, so
+// a lookup costs the same at any depth. The globals are only written while
+// globals and function signatures are added. Tables made with SYT_NewLocal
+// then check function bodies on other threads, reading the globals from
+// the table that holds them without writing to it.
+struct symtable
+{
+	Ast * ast;
+	SymTable * global;  // Table holding the globals, NULL if it is this one
+	Slot * slots;
+	unsigned nSlots;
+	unsigned nUsed;
+	Binding * bindings;
+	int nBindings;
+	int maxBindings;
+	Scope * scopes;     // Open scopes with bindings, innermost last
 	int nScopes;
 	int maxScopes;
+	int currentId;      // Innermost open scope, with bindings or not
+	int nextScopeId;    // Ids only need to differ along the open scopes
 	int nSymbols;
-	int id;
-	Hash * symbols;	
+	Cache * cache;      // Results of unchanged functions, NULL if none
 };
 
-Scope * SCO_New( int id )
+static void SYT_PushScope( SymTable * syt, int id );
+
+static SymTable * SYT_Alloc( SymTable * global, int nextScopeId )
 {
-	Scope * scope = ( Scope* )malloc( sizeof( Scope ) );
-	scope->parent = NULL;
-	scope->scopes = ( Scope** )malloc( MAX_SCOPES * sizeof( Scope* ) );
-	scope->nScopes = 0;
-	scope->maxScopes = MAX_SCOPES;
-	scope->nSymbols = 0;
-	scope->symbols = NULL;
-	scope->id = id;
-	
-	int i;
+	SymTable * syt = ( SymTable* )malloc( sizeof( SymTable ) );
+	STS_CountAlloc();
+	syt->ast = global ? global->ast : NULL;
+	syt->global = global;
+	syt->nSlots = SYT_INITIAL_SLOTS;
+	syt->nUsed = 0;
+	syt->slots = ( Slot* )calloc( syt->nSlots, sizeof( Slot ) );
+	syt->maxBindings = SYT_INITIAL_BINDINGS;
+	syt->nBindings = 0;
+	syt->bindings = ( Binding* )malloc( syt->maxBindings * sizeof( Binding ) );
+	syt->maxScopes = SYT_INITIAL_SCOPES;
+	syt->nScopes = 0;
+	syt->scopes = ( Scope* )malloc( syt->maxScopes * sizeof( Scope ) );
+	syt->nextScopeId = nextScopeId;
+	syt->nSymbols = 0;
+	syt->cache = global ? global->cache : NULL;
 	
-	for( i = 0; i < MAX_SCOPES; i++ )
-		scope->scopes[i] = NULL;
+	// Global scope
+	syt->currentId = 1;
+	SYT_PushScope( syt, 1 );
 	
-	return scope;
+	return syt;
 }
 
-void SCO_Delete( Scope * scope )
+SymTable * SYT_New()
 {
-	if( !scope )
-		return;
-		
-	int i;
-	Hash *h, *tmp;
-	
-	for( i = 0; i < scope->nScopes; i++ )
-	{
-		SCO_Delete( scope->scopes[i] );		
-	}
+	return SYT_Alloc( NULL, 2 );
+}
 
-	free( scope->scopes );
-	
-	HASH_ITER( hh, scope->symbols, h, tmp ) 
-	{
-        HASH_DEL( scope->symbols, h );
-        free( h );
-    }    
-	
-	free( scope );
+// Table reading the globals from syt, for checking function bodies
+static SymTable * SYT_NewLocal( SymTable * syt )
+{
+	return SYT_Alloc( syt, syt->nextScopeId );
 }
 
-void SCO_AppendScope( Scope * parent, Scope * child )
+void SYT_Delete( SymTable * syt )
 {
-	if( !parent )
-	{
-	    free( child );
-		return;
-	}
-		
-	if( !child )
-		return;
-		
-	child->parent = parent;
-	
-	if( parent->nScopes == parent->maxScopes )
-	{
-		parent->maxScopes *= 2;
-		parent->scopes = realloc( parent->scopes, parent->maxScopes * sizeof( Scope* ) );
-	}
-	
-	parent->scopes[parent->nScopes++] = child;
+	free( syt->slots );
+	free( syt->bindings );
+	free( syt->scopes );
+	free( syt );
 }
 
-void SYT_ProcessNode( SymTable * syt, Ast * ast );
-void SYT_VisitExpression( SymTable * syt, Ast * ast );
+static unsigned SYT_Hash( char * name )
+{
+    // Interned names are at least 8 byte aligned
+    return ( unsigned )( ( ( unsigned long )name >> 3 ) * 2654435761u );
+}
 
-struct symtable
+// Slot of name, or the empty one where it goes
+static Slot * SYT_Probe( SymTable * syt, char * name )
 {
-	Ast * ast;
-	Scope * root;
-	Scope * current;
-};
+    unsigned i = SYT_Hash( name ) & ( syt->nSlots - 1 );
+    
+    while( syt->slots[i].name && syt->slots[i].name != name )
+        i = ( i + 1 ) & ( syt->nSlots - 1 );
+        
+    return &syt->slots[i];
+}
 
+static void SYT_Grow( SymTable * syt )
+{
+    Slot * old = syt->slots;
+    unsigned oldSize = syt->nSlots;
+    unsigned i;
+    
+    syt->nSlots = oldSize * 2;
+    syt->slots = ( Slot* )calloc( syt->nSlots, sizeof( Slot ) );
+    syt->nUsed = 0;
+    
+    for( i = 0; i < oldSize; i++ )
+    {
+        if( old[i].name && old[i].binding >= 0 )
+        {
+            *SYT_Probe( syt, old[i].name ) = old[i];
+            syt->nUsed++;
+        }
+    }
+    
+    free( old );
+}
 
-SymTable * SYT_New()
+static void SYT_PushScope( SymTable * syt, int id )
 {
-	SymTable * syt = ( SymTable* )malloc( sizeof( SymTable ) );
-	syt->ast = NULL;
-	syt->root = SCO_New( scopeIdGen++ );
-	syt->current = syt->root;
+	if( syt->nScopes == syt->maxScopes )
+	{
+		syt->maxScopes *= 2;
+		syt->scopes = ( Scope* )realloc( syt->scopes, syt->maxScopes * sizeof( Scope ) );
+	}
 	
-	return syt;
+	syt->scopes[syt->nScopes].id = id;
+	syt->scopes[syt->nScopes].firstBinding = syt->nBindings;
+	syt->nScopes++;
 }
 
-void SYT_Delete( SymTable * syt )
+// Opening a scope only gives it an id, most blocks declare nothing and
+// share their parent's bindings. The scope is pushed by the first symbol
+// added to it. Returns the id to hand back to SYT_CloseScope.
+int SYT_OpenScope( SymTable * syt )
 {
-	SCO_Delete( syt->root );
-	free( syt );
+	int outerId = syt->currentId;
+	
+	syt->currentId = syt->nextScopeId++;
+	
+	return outerId;
 }
 
-void SYT_OpenScope( SymTable * syt )
+// Scope of a function's parameters. It takes the id of the function's body
+// block, so redefining a parameter there is an error, and both end up
+// with the same bindings.
+int SYT_OpenFriendScope( SymTable * syt )
 {
-	Scope * newScope = SCO_New( scopeIdGen++ );
-
-	SCO_AppendScope( syt->current, newScope );
-	syt->current = newScope;
+	int outerId = syt->currentId;
+	
+	syt->currentId = syt->nextScopeId;
+	
+	return outerId;
 }
 
-void SYT_OpenFriendScope( SymTable * syt )
+static void SYT_PopScope( SymTable * syt )
 {
-	Scope * newScope = SCO_New( scopeIdGen );
-
-	SCO_AppendScope( syt->current, newScope );
-	syt->current = newScope;
+	Scope * scope = &syt->scopes[--syt->nScopes];
+	
+	while( syt->nBindings > scope->firstBinding )
+	{
+	    Binding * b = &syt->bindings[--syt->nBindings];
+	    
+	    SYT_Probe( syt, b->name )->binding = b->shadowed;
+	}
 }
 
-void SYT_CloseScope( SymTable * syt )
+// Pops the bindings of the innermost scope, if it has any, uncovering the
+// ones they shadowed
+void SYT_CloseScope( SymTable * syt, int outerId )
 {
-	if( !syt->current )
-		return;
+	if( syt->nScopes > 1 && syt->scopes[syt->nScopes - 1].id == syt->currentId )
+		SYT_PopScope( syt );
 		
-	syt->current = syt->current->parent;
+	syt->currentId = outerId;
 }
 
-int SYT_CheckSymbol( SymTable * syt, char * idName, Symbol ** s )
+// Innermost binding of idName, in this table or else in the global one
+static Binding * SYT_FindSymbol( SymTable * syt, char * idName )
 {
-	Hash * h;
-	Scope * current = syt->current;		
-       
-    do
-    {            
-        HASH_FIND_STR( current->symbols, idName, h );
+    Slot * slot = SYT_Probe( syt, idName );
+    
+    if( slot->name && slot->binding >= 0 )
+        return &syt->bindings[slot->binding];
         
-        if( h )
-        {
-            *s = h->symbol;
-            SYM_SetScopeId( *s, current->id );
-            return SYM_GetType( h->symbol ); 
-        }           
+    if( syt->global )
+        return SYT_FindSymbol( syt->global, idName );
         
-        current = current->parent;
+    return NULL;
+}
+
+int SYT_CheckSymbol( SymTable * syt, char * idName, Symbol ** s )
+{
+    Binding * b = SYT_FindSymbol( syt, idName );
+    
+    if( b )
+    {
+        *s = b->symbol;
+        return SYM_GetType( b->symbol ); 
     }
-    while( current );
     
     return 0;
 }
@@ -216,31 +316,51 @@ int SYT_AddSymbol( SymTable * syt, char * idName, Symbol * s )
     if( !idName )
         return 0;
     
-    Symbol * existing;
-    int check = SYT_CheckSymbol( syt, idName, &existing );
+    Binding * existing = SYT_FindSymbol( syt, idName );
+    int scopeId = syt->currentId;
     
-    if( !check || ( check && syt->current->id != SYM_GetScopeId( existing ) ) ) 
+    if( existing && existing->scopeId == scopeId )
+        return 0;
+        
+    if( syt->scopes[syt->nScopes - 1].id != scopeId )
+        SYT_PushScope( syt, scopeId );
+        
+    if( 2 * ( syt->nUsed + 1 ) > syt->nSlots )
+        SYT_Grow( syt );
+        
+    if( syt->nBindings == syt->maxBindings )
     {
-	    Hash * h = ( Hash* )malloc( sizeof( Hash ) );
-	    h->id = idName;
-	    h->symbol = s;	    
-	
-	    HASH_ADD_STR( syt->current->symbols, id, h ); //This works cuz macros
-	    syt->current->nSymbols++;
-	    
-	    return 1;
-	}
-	
-	return 0;
+        syt->maxBindings *= 2;
+        syt->bindings = ( Binding* )realloc( syt->bindings, syt->maxBindings * sizeof( Binding ) );
+    }
+        
+    Slot * slot = SYT_Probe( syt, idName );
+    Binding * b = &syt->bindings[syt->nBindings];
+    
+    if( !slot->name )
+    {
+        slot->name = idName;
+        slot->binding = -1;
+        syt->nUsed++;
+    }
+    
+    b->name = idName;
+    b->symbol = s;
+    b->scopeId = scopeId;
+    b->shadowed = slot->binding;
+    slot->binding = syt->nBindings++;
+    syt->nSymbols++;
+    
+    return 1;
 }
 
-void SYT_VisitDeclaration( SymTable * syt, Ast * ast )
+void SYT_VisitDeclaration( SymTable * syt, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
+    AstNode child = AST_GetChild( ast );
     char * name = AST_GetNodeValue( child );
     int ptrType;	                
     int type = SYM_StringToType( AST_FindType( ast, &ptrType ) );
-    Symbol * s = SYM_New( type, ptrType ); 
+    Symbol * s = SYM_Type( type, ptrType ); 
         
     if( !SYT_AddSymbol( syt, name, s ) )	                
         errorSymbol( ERROR_REDEFINED, name, AST_GetNodeLine( ast ) );
@@ -249,7 +369,7 @@ void SYT_VisitDeclaration( SymTable * syt, Ast * ast )
     AST_Annotate( ast, s );
 }
 
-void SYT_VisitID( SymTable * syt, Ast * ast )
+void SYT_VisitID( SymTable * syt, AstNode ast )
 {
     char * name = AST_GetNodeValue( ast );
     Symbol * s;
@@ -261,48 +381,22 @@ void SYT_VisitID( SymTable * syt, Ast * ast )
     AST_Annotate( ast, s );
 }
 
-void SYT_VisitAssign( SymTable * syt, Ast * ast )
+void SYT_VisitAssign( SymTable * syt, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
+    AstNode child = AST_GetChild( ast );
     SYT_VisitExpression( syt, child );
     
     Symbol * s1 = AST_GetNodeAnnotation( child );
-    int type1 = SYM_GetType( s1 );
-    int ptrType1 = SYM_GetPtrType( s1 );
     
     child = AST_NextSibling( child );
     SYT_VisitExpression( syt, child );    
         
     Symbol * s2 = AST_GetNodeAnnotation( child );
-    int type2 = SYM_GetType( s2 );
-    int ptrType2 = SYM_GetPtrType( s2 );
-    
-    free( child );
-    
-    errorTyping( ptrType1 == ptrType2, "Expressions not matching type.", AST_GetNodeLine( ast ) );
     
-    if( ptrType1 == 0 )
-    {
-        if( type1 == S_CHAR )
-        {
-            errorTyping( ( type2 == S_CHAR || type2 == S_INT ), "Expressions not matching type.", AST_GetNodeLine( ast ) );
-        }
-        else if( type2 == S_CHAR )
-        {
-            errorTyping( ( type1 == S_CHAR || type1 == S_INT ), "Expressions not matching type.", AST_GetNodeLine( ast ) );
-        }
-        else
-        {
-            errorTyping( type1 == type2, "Expressions not matching type.", AST_GetNodeLine( ast ) );
-        }
-    }
-    else
-    {
-        errorTyping( type1 == type2, "Expressions not matching type.", AST_GetNodeLine( ast ) );
-    }
+    errorTyping( SYM_Matches( s1, s2 ), "Expressions not matching type.", AST_GetNodeLine( ast ) );
 }
 
-void SYT_VisitCall( SymTable * syt, Ast * ast )
+void SYT_VisitCall( SymTable * syt, AstNode ast )
 {
     char * name = AST_FindId( ast );
     Symbol * s;
@@ -311,7 +405,7 @@ void SYT_VisitCall( SymTable * syt, Ast * ast )
     if( !type )	                
         errorSymbol( ERROR_UNDECLARED, name, AST_GetNodeLine( ast ) );
     
-    Ast * args = AST_GetChild( ast );
+    AstNode args = AST_GetChild( ast );
     args = AST_NextSibling( args );
     
     if( !AST_GetNodeAnnotation( args ) )
@@ -322,18 +416,16 @@ void SYT_VisitCall( SymTable * syt, Ast * ast )
         
     int garbage = SYT_CheckSymbol( syt, name, &s1 );
     
-    free( args );
-    
     errorTyping( SYM_CompareParams( s1, s2 ), "Expression does not match function parameter type.", AST_GetNodeLine( ast ) );    
     
     AST_Annotate( ast, s );
 }
 
-void SYT_VisitIf( SymTable * syt, Ast * ast )
+void SYT_VisitIf( SymTable * syt, AstNode ast )
 {
-    Ast * child;
+    AstNode child;
     
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
     {
         if( AST_GetNodeType( child ) == A_BLOCK )
             continue;
@@ -348,9 +440,9 @@ void SYT_VisitIf( SymTable * syt, Ast * ast )
     }    
 }
 
-void SYT_VisitWhile( SymTable * syt, Ast * ast )
+void SYT_VisitWhile( SymTable * syt, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
+    AstNode child = AST_GetChild( ast );
     SYT_VisitExpression( syt, child );
     
     Symbol * s = AST_GetNodeAnnotation( child );
@@ -358,55 +450,50 @@ void SYT_VisitWhile( SymTable * syt, Ast * ast )
     int expPtrType = SYM_GetPtrType( s );    
     
     errorTyping( ( expType == S_BOOL && expPtrType == 0 ), "Expression does not evaluate to type \'bool\'.", AST_GetNodeLine( child ) );
-            
-    free( child );
 }
  
-void SYT_VisitReturn( SymTable * syt, Ast * ast )
+void SYT_VisitReturn( SymTable * syt, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
-    Symbol * s = SYM_New( S_VOID, 0 );
+    AstNode child = AST_GetChild( ast );
+    Symbol * s = SYM_Type( S_VOID, 0 );
     
-    if( child )
+    if( !AST_IsNull( child ) )
     {
-        free( s );
         SYT_VisitExpression( syt, child );
         s = AST_GetNodeAnnotation( child );
     }
     
     AST_Annotate( ast, s );
-    
-    free( child );
 }
            
-void SYT_VisitParams( SymTable * syt, Ast * ast )
+void SYT_VisitParams( SymTable * syt, AstNode ast )
 {
-    Ast * child;
+    AstNode child;
     
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
     {        
         SYT_VisitDeclaration( syt, child );
     }    
 }
 
-void SYT_VisitLitString( SymTable * syt, Ast * ast )
+void SYT_VisitLitString( SymTable * syt, AstNode ast )
 {
-    AST_Annotate( ast, SYM_New( S_CHAR, 1 ) );
+    AST_Annotate( ast, SYM_Type( S_CHAR, 1 ) );
 }
 
-void SYT_VisitLitInt( SymTable * syt, Ast * ast )
+void SYT_VisitLitInt( SymTable * syt, AstNode ast )
 {
-    AST_Annotate( ast, SYM_New( S_INT, 0 ) );
+    AST_Annotate( ast, SYM_Type( S_INT, 0 ) );
 }
 
-void SYT_VisitLitBool( SymTable * syt, Ast * ast )
+void SYT_VisitLitBool( SymTable * syt, AstNode ast )
 {
-    AST_Annotate( ast, SYM_New( S_BOOL, 0 ) );
+    AST_Annotate( ast, SYM_Type( S_BOOL, 0 ) );
 }
 
-void SYT_VisitVar( SymTable * syt, Ast * ast )
+void SYT_VisitVar( SymTable * syt, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
+    AstNode child = AST_GetChild( ast );
     Symbol * s = AST_GetNodeAnnotation( child );
     int type = SYM_GetType( s );
     int ptrType = SYM_GetPtrType( s );    
@@ -415,7 +502,7 @@ void SYT_VisitVar( SymTable * syt, Ast * ast )
     
     child = AST_NextSibling( child );
     
-    while( child )
+    while( !AST_IsNull( child ) )
     {        
         count++;     
         
@@ -430,15 +517,15 @@ void SYT_VisitVar( SymTable * syt, Ast * ast )
     
     errorTyping( count <= ptrType, "Expression does not match expected pointer dimension.", AST_GetNodeLine( ast ) );
     
-    AST_Annotate( ast, SYM_New( type, ptrType - count ) );
+    AST_Annotate( ast, SYM_Type( type, ptrType - count ) );
 }
 
-void SYT_VisitArgs( SymTable * syt, Ast * ast )
+void SYT_VisitArgs( SymTable * syt, AstNode ast )
 {
     Symbol * sym = SYM_New( S_VOID, 0 );
-    Ast * child;
+    AstNode child;
     
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
     {
         Symbol * s = AST_GetNodeAnnotation( child );
         int type = SYM_GetType( s );
@@ -447,12 +534,13 @@ void SYT_VisitArgs( SymTable * syt, Ast * ast )
         SYM_PushParam( sym, type, ptrType );
     }
     
+    SYM_EndParams( sym );
     AST_Annotate( ast, sym );
 }
 
-void SYT_VisitNew( SymTable * syt, Ast * ast )
+void SYT_VisitNew( SymTable * syt, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
+    AstNode child = AST_GetChild( ast );
     Symbol * s = AST_GetNodeAnnotation( child );
     int type = SYM_GetType( s );
     int ptrType = SYM_GetPtrType( s );
@@ -462,43 +550,40 @@ void SYT_VisitNew( SymTable * syt, Ast * ast )
     child = AST_NextSibling( child );
     type = SYM_StringToType( AST_FindType( ast, &ptrType ) );
     
-    AST_Annotate( ast, SYM_New( type, ptrType + 1 ) );
+    AST_Annotate( ast, SYM_Type( type, ptrType + 1 ) );
 }
 
-void SYT_VisitNot( SymTable * syt, Ast * ast )
+void SYT_VisitNot( SymTable * syt, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
+    AstNode child = AST_GetChild( ast );
     Symbol * s = AST_GetNodeAnnotation( child );
     int type = SYM_GetType( s );
     int ptrType = SYM_GetPtrType( s );
     
-    free( child );
-    
     errorTyping( ( type == S_BOOL && ptrType == 0 ), "Expression does not evaluate to type \'bool\'.", AST_GetNodeLine( child ) );    
     
-    AST_Annotate( ast, SYM_New( S_BOOL, 0 ) );
+    AST_Annotate( ast, SYM_Type( S_BOOL, 0 ) );
 }
 
-void SYT_VisitNegative( SymTable * syt, Ast * ast )
+void SYT_VisitNegative( SymTable * syt, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
+    AstNode child = AST_GetChild( ast );
     Symbol * s = AST_GetNodeAnnotation( child );
     int type = SYM_GetType( s );
     int ptrType = SYM_GetPtrType( s );    
     
     int line = AST_GetNodeLine( child );
-    free( child );
     
     errorTyping( ( ( type == S_INT || S_CHAR ) && ptrType == 0 ), "Expression does not evaluate to type \'int\'.", line );    
     
-    AST_Annotate( ast, SYM_New( S_INT, 0 ) );
+    AST_Annotate( ast, SYM_Type( S_INT, 0 ) );
 }
 
-void SYT_VisitArithmitic( SymTable * syt, Ast * ast )
+void SYT_VisitArithmitic( SymTable * syt, AstNode ast )
 {
-    Ast * child;
+    AstNode child;
     
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
     {
         Symbol * s = AST_GetNodeAnnotation( child );
         int type = SYM_GetType( s );
@@ -507,14 +592,14 @@ void SYT_VisitArithmitic( SymTable * syt, Ast * ast )
         errorTyping( ( ( type == S_INT || type == S_CHAR ) && ptrType == 0 ), "Expression does not evaluate to type \'int\'.", AST_GetNodeLine( child ) );
     }
     
-    AST_Annotate( ast, SYM_New( S_INT, 0 ) );
+    AST_Annotate( ast, SYM_Type( S_INT, 0 ) );
 }
 
-void SYT_VisitLogic( SymTable * syt, Ast * ast )
+void SYT_VisitLogic( SymTable * syt, AstNode ast )
 {
-    Ast * child;
+    AstNode child;
     
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
     {
         Symbol * s = AST_GetNodeAnnotation( child );
         int type = SYM_GetType( s );
@@ -523,12 +608,12 @@ void SYT_VisitLogic( SymTable * syt, Ast * ast )
         errorTyping( ( type == S_BOOL && ptrType == 0 ), "Expression does not evaluate to type \'bool\'.", AST_GetNodeLine( child ) ); 
     }
     
-    AST_Annotate( ast, SYM_New( S_BOOL, 0 ) );
+    AST_Annotate( ast, SYM_Type( S_BOOL, 0 ) );
 }
 
-void SYT_VisitEqual( SymTable * syt, Ast * ast )
+void SYT_VisitEqual( SymTable * syt, AstNode ast )
 {
-    Ast * child = AST_GetChild( ast );
+    AstNode child = AST_GetChild( ast );
     Symbol * s1 = AST_GetNodeAnnotation( child );
     int type1 = SYM_GetType( s1 );
     int ptrType1 = SYM_GetPtrType( s1 );
@@ -553,14 +638,14 @@ void SYT_VisitEqual( SymTable * syt, Ast * ast )
         errorTyping( type1 == type2, "Expressions not matching type.", AST_GetNodeLine( child ) );
     }
     
-    AST_Annotate( ast, SYM_New( S_BOOL, 0 ) );
+    AST_Annotate( ast, SYM_Type( S_BOOL, 0 ) );
 }
 
-void SYT_VisitComparison( SymTable * syt, Ast * ast )
+void SYT_VisitComparison( SymTable * syt, AstNode ast )
 {
-    Ast * child;
+    AstNode child;
     
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
     {
         Symbol * s = AST_GetNodeAnnotation( child );
         int type = SYM_GetType( s );
@@ -569,14 +654,14 @@ void SYT_VisitComparison( SymTable * syt, Ast * ast )
         errorTyping( ( ( type == S_INT || type == S_CHAR ) && ptrType == 0 ), "Expression does not evaluate to type \'int\'.", AST_GetNodeLine( child ) );        
     }
     
-    AST_Annotate( ast, SYM_New( S_BOOL, 0 ) );
+    AST_Annotate( ast, SYM_Type( S_BOOL, 0 ) );
 }
 
-void SYT_VisitExpression( SymTable * syt, Ast * ast )
+void SYT_VisitExpression( SymTable * syt, AstNode ast )
 {
-    Ast * child;
+    AstNode child;
     
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
         SYT_VisitExpression( syt, child );    
     
     int nodeType = AST_GetNodeType( ast );
@@ -650,20 +735,20 @@ void SYT_VisitExpression( SymTable * syt, Ast * ast )
     }
 }
 
-void SYT_VisitFunction( SymTable * syt, Ast * ast )
+void SYT_VisitFunction( SymTable * syt, AstNode ast )
 {
     char * name = AST_FindId( ast );
     int ptrType;	                
     int type = SYM_StringToType( AST_FindType( ast, &ptrType ) );
     Symbol * s = SYM_New( type, ptrType );
-    Ast * params = AST_GetChild( ast );
+    AstNode params = AST_GetChild( ast );
     params = AST_NextSibling( params );
     
     if( AST_GetNodeType( params ) == A_PARAMS )
     {
-        Ast * child;
+        AstNode child;
         
-        for( child = AST_GetChild( params ); child; child = AST_NextSibling( child ) )
+        for( child = AST_GetChild( params ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	    {
 	        if( AST_GetNodeType( child ) == A_DECLVAR )
 	        {
@@ -673,19 +758,19 @@ void SYT_VisitFunction( SymTable * syt, Ast * ast )
                 SYM_PushParam( s, paramType, paramPtrType );
 	        }
 	    }
+	    
+	    SYM_EndParams( s );
 	}
 	
-	free( params );
-	
     if( !SYT_AddSymbol( syt, name, s ) )
         errorSymbol( ERROR_REDEFINED, name, AST_GetNodeLine( ast ) );
 }
 
-void SYT_VisitGlobals( SymTable * syt, Ast * ast )
+void SYT_VisitGlobals( SymTable * syt, AstNode ast )
 {
-    Ast * child;	
+    AstNode child;	
 	
-	for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+	for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
 	    switch( AST_GetNodeType( child ) )
 	    {
@@ -704,12 +789,12 @@ void SYT_VisitGlobals( SymTable * syt, Ast * ast )
 	}
 }
 
-int SYT_AssertReturns( SymTable * syt, Ast * ast, int type, int ptrType )
+int SYT_AssertReturns( SymTable * syt, AstNode ast, int type, int ptrType )
 {
-    Ast * child;
+    AstNode child;
     int foundReturn = 0;
     
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
 	    if( AST_GetNodeType( child ) == A_RETURN )
 	    {
@@ -749,16 +834,18 @@ int SYT_AssertReturns( SymTable * syt, Ast * ast, int type, int ptrType )
 	return foundReturn;
 }
 
-void SYT_ProcessNode( SymTable * syt, Ast * ast )
+void SYT_ProcessNode( SymTable * syt, AstNode ast )
 {
+    int outerId = 0;
+    
     switch( AST_GetNodeType( ast ) )
     {
         case A_FUNCTION:
-            SYT_OpenFriendScope( syt );
+            outerId = SYT_OpenFriendScope( syt );
             break;
             
         case A_BLOCK:
-            SYT_OpenScope( syt );
+            outerId = SYT_OpenScope( syt );
             break;
             
         case A_ID:
@@ -794,9 +881,9 @@ void SYT_ProcessNode( SymTable * syt, Ast * ast )
             break;                    
     }
     
-    Ast * child;
+    AstNode child;
 	
-	for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+	for( child = AST_GetChild( ast ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
 	    if( !AST_GetNodeAnnotation( child ) )	
 	        SYT_ProcessNode( syt, child );
@@ -805,7 +892,7 @@ void SYT_ProcessNode( SymTable * syt, Ast * ast )
 	// Assert return of function
 	if( AST_GetNodeType( ast ) == A_FUNCTION )
 	{
-	    SYT_CloseScope( syt );
+	    SYT_CloseScope( syt, outerId );
 	    
 	    Symbol * s;
 	    int type = SYT_CheckSymbol( syt, AST_FindId( ast ), &s );
@@ -814,25 +901,363 @@ void SYT_ProcessNode( SymTable * syt, Ast * ast )
 	}
 	    
 	if( AST_GetNodeType( ast ) == A_BLOCK )
-	    SYT_CloseScope( syt );
+	    SYT_CloseScope( syt, outerId );
+}
+
+/********************************************************************/
+
+#define SYT_CACHE_NONE      0
+#define SYT_CACHE_TYPE      1   // Shared plain type, see SYM_Type
+#define SYT_CACHE_GLOBAL    2   // Global symbol of the node's name
+#define SYT_CACHE_SIGNATURE 3
+
+static void SYT_HashSymbol( unsigned long long * key, Symbol * s )
+{
+    int values[3];
+    int i;
+    
+    values[0] = SYM_GetType( s );
+    values[1] = SYM_GetPtrType( s );
+    values[2] = SYM_GetParamCount( s );
+    *key = CCH_Hash( *key, values, sizeof( values ) );
+    
+    for( i = 0; i < values[2]; i++ )
+    {
+        SYM_GetParam( s, i, &values[0], &values[1] );
+        *key = CCH_Hash( *key, values, 2 * sizeof( int ) );
+    }
+}
+
+// Name whose global symbol a node may be annotated with
+static char * SYT_AnnotatedName( AstNode node )
+{
+    switch( AST_GetNodeType( node ) )
+    {
+        case A_ID:
+            return AST_GetNodeValue( node );
+            
+        case A_CALL:
+            return AST_FindId( node );
+    }
+    
+    return NULL;
+}
+
+// Covers the function's nodes, lines aside, and the global symbol of every
+// name in it. Whatever else the check of its body reads is local to it.
+static unsigned long long SYT_FunctionKey( SymTable * syt, AstNode ast )
+{
+    SymTable * global = syt->global ? syt->global : syt;
+    unsigned long long key = CCH_HASH_SEED;
+    int size = AST_GetTreeSize( ast );
+    AstNode node = ast;
+    int i;
+    
+    for( i = 0; i < size; i++, node = AST_NextInOrder( node ) )
+    {
+        int values[2];
+        char * value = AST_GetNodeValue( node );
+        
+        values[0] = AST_GetNodeType( node );
+        values[1] = AST_GetTreeSize( node );
+        key = CCH_Hash( key, values, sizeof( values ) );
+        
+        if( value )
+            key = CCH_Hash( key, value, strlen( value ) + 1 );
+        
+        if( values[0] == A_ID )
+        {
+            Binding * b = SYT_FindSymbol( global, value );
+            
+            if( b )
+                SYT_HashSymbol( &key, b->symbol );
+            else
+                key = CCH_Hash( key, "?", 1 );
+        }
+    }
+    
+    return key;
+}
+
+static void SYT_StoreFunction( SymTable * syt, AstNode ast, int function, int nSymbols )
+{
+    SymTable * global = syt->global ? syt->global : syt;
+    int size = AST_GetTreeSize( ast );
+    AstNode node = ast;
+    int i;
+    int j;
+    
+    CCH_PutInt( syt->cache, function, CCH_TYPING, nSymbols );
+    
+    for( i = 0; i < size; i++, node = AST_NextInOrder( node ) )
+    {
+        Symbol * s = AST_GetNodeAnnotation( node );
+        char * name = SYT_AnnotatedName( node );
+        Binding * b = name ? SYT_FindSymbol( global, name ) : NULL;
+        
+        if( !s )
+        {
+            CCH_PutInt( syt->cache, function, CCH_TYPING, SYT_CACHE_NONE );
+        }
+        else if( s == SYM_Type( SYM_GetType( s ), SYM_GetPtrType( s ) ) )
+        {
+            CCH_PutInt( syt->cache, function, CCH_TYPING, SYT_CACHE_TYPE );
+            CCH_PutInt( syt->cache, function, CCH_TYPING, SYM_GetType( s ) );
+            CCH_PutInt( syt->cache, function, CCH_TYPING, SYM_GetPtrType( s ) );
+        }
+        else if( b && b->symbol == s )
+        {
+            CCH_PutInt( syt->cache, function, CCH_TYPING, SYT_CACHE_GLOBAL );
+        }
+        else
+        {
+            int nParams = SYM_GetParamCount( s );
+            
+            CCH_PutInt( syt->cache, function, CCH_TYPING, SYT_CACHE_SIGNATURE );
+            CCH_PutInt( syt->cache, function, CCH_TYPING, SYM_GetType( s ) );
+            CCH_PutInt( syt->cache, function, CCH_TYPING, SYM_GetPtrType( s ) );
+            CCH_PutInt( syt->cache, function, CCH_TYPING, nParams );
+            
+            for( j = 0; j < nParams; j++ )
+            {
+                int type;
+                int ptrType;
+                
+                SYM_GetParam( s, j, &type, &ptrType );
+                CCH_PutInt( syt->cache, function, CCH_TYPING, type );
+                CCH_PutInt( syt->cache, function, CCH_TYPING, ptrType );
+            }
+        }
+    }
+}
+
+static void SYT_RestoreFunction( SymTable * syt, AstNode ast, int function )
+{
+    SymTable * global = syt->global ? syt->global : syt;
+    int size = AST_GetTreeSize( ast );
+    AstNode node = ast;
+    int i;
+    int j;
+    
+    syt->nSymbols += CCH_GetInt( syt->cache, function, CCH_TYPING );
+    
+    for( i = 0; i < size; i++, node = AST_NextInOrder( node ) )
+    {
+        int code = CCH_GetInt( syt->cache, function, CCH_TYPING );
+        
+        if( code == SYT_CACHE_TYPE )
+        {
+            int type = CCH_GetInt( syt->cache, function, CCH_TYPING );
+            int ptrType = CCH_GetInt( syt->cache, function, CCH_TYPING );
+            
+            AST_Annotate( node, SYM_Type( type, ptrType ) );
+        }
+        else if( code == SYT_CACHE_GLOBAL )
+        {
+            AST_Annotate( node, SYT_FindSymbol( global, SYT_AnnotatedName( node ) )->symbol );
+        }
+        else if( code == SYT_CACHE_SIGNATURE )
+        {
+            int type = CCH_GetInt( syt->cache, function, CCH_TYPING );
+            int ptrType = CCH_GetInt( syt->cache, function, CCH_TYPING );
+            int nParams = CCH_GetInt( syt->cache, function, CCH_TYPING );
+            Symbol * s = SYM_New( type, ptrType );
+            
+            for( j = 0; j < nParams; j++ )
+            {
+                type = CCH_GetInt( syt->cache, function, CCH_TYPING );
+                ptrType = CCH_GetInt( syt->cache, function, CCH_TYPING );
+                SYM_PushParam( s, type, ptrType );
+            }
+            
+            SYM_EndParams( s );
+            AST_Annotate( node, s );
+        }
+    }
+}
+
+// Checks a function body, unless its key shows the cache already holds
+// the annotations that checking it gives
+static void SYT_CheckFunction( SymTable * syt, AstNode ast, int function )
+{
+    if( !syt->cache )
+    {
+        SYT_ProcessNode( syt, ast );
+        return;
+    }
+    
+    if( CCH_Lookup( syt->cache, function, SYT_FunctionKey( syt, ast ) ) )
+    {
+        SYT_RestoreFunction( syt, ast, function );
+        return;
+    }
+    
+    int nSymbols = syt->nSymbols;
+    
+    SYT_ProcessNode( syt, ast );
+    SYT_StoreFunction( syt, ast, function, syt->nSymbols - nSymbols );
+}
+
+void SYT_SetCache( SymTable * syt, Cache * cache )
+{
+    syt->cache = cache;
 }
 
 void SYT_Build( SymTable * syt, Ast * ast )
 {
+	AstNode root = AST_GetRoot( ast );
+	int nFunctions = 0;
+	
 	syt->ast = ast;	
 	
-	SYT_VisitGlobals( syt, ast );
+	SYT_VisitGlobals( syt, root );
+	
+	AstNode child;
 	
-	Ast * child;
+    for( child = AST_GetChild( root ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
+	{
+        if( AST_GetNodeType( child ) != A_DECLVAR )
+            nFunctions++;
+    }
+    
+    if( syt->cache )
+        CCH_Reserve( syt->cache, nFunctions );
+    
+    nFunctions = 0;
 		
-    for( child = AST_GetChild( ast ); child; child = AST_NextSibling( child ) )
+    for( child = AST_GetChild( root ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
 	{
         if( AST_GetNodeType( child ) != A_DECLVAR )
         {
-            SYT_ProcessNode( syt, child );
+            SYT_CheckFunction( syt, child, nFunctions++ );
         }
     }
     
     fprintf( stdout, "Typing successful!\n" ); 
 }
 
+/********************************************************************/
+
+typedef struct functionQueue FunctionQueue;
+
+struct functionQueue
+{
+    SymTable * syt;
+    AstNode * functions;
+    char ** errors;         // First error of each function, NULL if none
+    int nFunctions;
+    int next;               // Next function to be taken by a worker
+    int firstFailed;        // Functions past it need no checking
+    int nSymbols;
+};
+
+static void * SYT_Worker( void * arg )
+{
+    FunctionQueue * queue = ( FunctionQueue* )arg;
+    SymTable * local = SYT_NewLocal( queue->syt );
+    jmp_buf env;
+    int i;
+    
+    while( ( i = __atomic_fetch_add( &queue->next, 1, __ATOMIC_RELAXED ) ) < queue->nFunctions )
+    {
+        if( i > __atomic_load_n( &queue->firstFailed, __ATOMIC_RELAXED ) )
+            break;
+            
+        if( setjmp( env ) == 0 )
+        {
+            recovery = &env;
+            SYT_CheckFunction( local, queue->functions[i], i );
+        }
+        else
+        {
+            int seen = __atomic_load_n( &queue->firstFailed, __ATOMIC_RELAXED );
+            
+            queue->errors[i] = failure;
+            failure = NULL;
+            
+            while( local->nScopes > 1 )
+                SYT_PopScope( local );
+                
+            local->currentId = 1;
+                
+            while( i < seen && !__atomic_compare_exchange_n( &queue->firstFailed, &seen, i, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+                ;
+        }
+        
+        recovery = NULL;
+    }
+    
+    __atomic_fetch_add( &queue->nSymbols, local->nSymbols, __ATOMIC_RELAXED );
+    SYT_Delete( local );
+    
+    return NULL;
+}
+
+// Same as SYT_Build, with function bodies checked by up to nJobs threads
+// once every global and signature is in. Only the error of the first
+// function that fails is printed, the one a serial check stops at.
+void SYT_BuildParallel( SymTable * syt, Ast * ast, int nJobs )
+{
+	AstNode root = AST_GetRoot( ast );
+	FunctionQueue queue;
+	pthread_t * threads;
+	AstNode child;
+	int i;
+	
+	syt->ast = ast;	
+	
+	SYT_VisitGlobals( syt, root );
+	
+	queue.syt = syt;
+	queue.functions = ( AstNode* )malloc( AST_GetSize( ast ) * sizeof( AstNode ) );
+	queue.nFunctions = 0;
+	queue.next = 0;
+	queue.nSymbols = 0;
+		
+    for( child = AST_GetChild( root ); !AST_IsNull( child ); child = AST_NextSibling( child ) )
+	{
+        if( AST_GetNodeType( child ) != A_DECLVAR )
+            queue.functions[queue.nFunctions++] = child;
+    }
+    
+    queue.errors = ( char** )calloc( queue.nFunctions, sizeof( char* ) );
+    
+    if( syt->cache )
+        CCH_Reserve( syt->cache, queue.nFunctions );
+    
+    queue.firstFailed = queue.nFunctions;
+    
+    if( nJobs > queue.nFunctions )
+        nJobs = queue.nFunctions;
+        
+    threads = ( pthread_t* )malloc( nJobs * sizeof( pthread_t ) );
+    
+    for( i = 0; i < nJobs; i++ )
+        pthread_create( &threads[i], NULL, &SYT_Worker, &queue );
+        
+    for( i = 0; i < nJobs; i++ )
+        pthread_join( threads[i], NULL );
+        
+    free( threads );
+    
+    for( i = 0; i < queue.nFunctions; i++ )
+    {
+        if( queue.errors[i] )
+        {
+            fputs( queue.errors[i], stderr );
+            exit( EXIT_FAILURE );
+        }
+    }
+    
+    syt->nSymbols += queue.nSymbols;
+    
+    free( queue.errors );
+    free( queue.functions );
+    
+    fprintf( stdout, "Typing successful!\n" ); 
+}
+
+int SYT_GetSymbolCount( SymTable * syt )
+{
+    return syt->nSymbols;
+}
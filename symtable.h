@@ -2,6 +2,7 @@
 #define SYMTABLE_H
 
 #include "ast.h"
+#include "cache.h"
 
 
 typedef struct symtable SymTable;
@@ -11,6 +12,12 @@ SymTable * SYT_New();
 
 void SYT_Delete( SymTable * syt );
 
+void SYT_SetCache( SymTable * syt, Cache * cache );
+
 void SYT_Build( SymTable * syt, Ast * ast );
 
+void SYT_BuildParallel( SymTable * syt, Ast * ast, int nJobs );
+
+int SYT_GetSymbolCount( SymTable * syt );
+
 #endif
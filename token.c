@@ -3,29 +3,36 @@
 #include <stdlib.h>
 
 #include "token.h"
+#include "intern.h"
+#include "stats.h"
 
 struct token
 {
     int type;
     int line;
+    const char * source;
+    int offset;
+    int length;
     char * text;
 };
 
-Token * TOK_New( char * text, int type, int line )
+Token * TOK_New( const char * source, int offset, int length, int type, int line )
 {
     Token* tok = malloc( sizeof( Token ) );
+    STS_CountAlloc();
     tok->type = type;
-    tok->text = strdup( text );
     tok->line = line;
+    tok->source = source;
+    tok->offset = offset;
+    tok->length = length;
+    tok->text = NULL;
 
     return tok;
 }
 
 void TOK_Delete( void * tok )
 {
-    Token * t = (Token*)tok;
-    free( t->text );
-    free( t );
+    free( tok );
 }
 
 int TOK_IsType( void * tok, int type )
@@ -53,7 +60,7 @@ void TOK_Dump( void * tok )
 {
     Token * t = (Token*)tok;
     printf( "%d\n", t->type );
-    printf( "%s @line %d\n", t->text, t->line );
+    printf( "%s @line %d\n", TOK_GetText( t ), t->line );
 }
 
 int TOK_GetType( void * tok )
@@ -61,8 +68,53 @@ int TOK_GetType( void * tok )
     return ((Token *)tok)->type;
 }
 
+// Interns the text of a token out of its source span: escapes of string
+// literals are resolved and hexadecimal literals are written in decimal
+static char * TOK_BuildText( Token * tok )
+{
+    const char * span = tok->source + tok->offset;
+    char * text;
+    int i, n = 0;
+    
+    if( tok->type == T_LITSTRING )
+    {
+        text = malloc( tok->length + 1 );
+        
+        for( i = 0; i < tok->length; i++ )
+        {
+            if( span[i] == '\\' && i + 1 < tok->length )
+            {
+                i++;
+                text[n++] = ( span[i] == 'n' ) ? '\n' : span[i];
+            }
+            else
+            {
+                text[n++] = span[i];
+            }
+        }
+        
+        char * interned = ITN_Intern( text, n );
+        free( text );
+        return interned;
+    }
+    
+    if( tok->type == T_LITINT && tok->length > 1 && span[1] == 'x' )
+    {
+        char decimal[12];
+        char * digits = strndup( span, tok->length );
+        sprintf( decimal, "%d", ( int )strtol( digits, NULL, 16 ) );
+        free( digits );
+        return ITN_InternString( decimal );
+    }
+    
+    return ITN_Intern( span, tok->length );
+}
+
 char * TOK_GetText( Token * tok )
 {
+    if( !tok->text )
+        tok->text = TOK_BuildText( tok );
+        
     return tok->text;
 }
 
@@ -63,7 +63,7 @@ int TOK_GetType( void * tok );
 
 /*********************/
 
-Token * TOK_New( char * text, int type, int line );
+Token * TOK_New( const char * source, int offset, int length, int type, int line );
 
 char * TOK_GetText( Token * tok );
 